@@ -0,0 +1,118 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+#include "merge.h"
+#include "order.h"
+#include "perf.h"
+#include "quick.h"
+#include "radix.h"
+#include "stats.h"
+
+// Number of positions sampled to measure presortedness
+#define adaptive_samples 1024
+
+// Descent ratio at or below which (or at or above one minus which)
+// the input is taken to be a few long runs
+#define adaptive_run_ratio (1.0 / 32)
+
+// Duplicate ratio at or above which three-way quicksort is chosen
+#define adaptive_dup_ratio 0.25
+
+/** @brief Sample input for runs, duplicates and limb-size spread.
+ *
+ *  Descents b[i+1] < b[i] are counted at evenly spaced positions; the
+ *  descent ratio estimates runs / n. Duplicates are counted among an
+ *  evenly spaced sample after sorting shallow copies of it.
+ *
+ *  @param b Big integer 'array' (data ptr & size struct).
+ *  @param order Order that descents are taken against.
+ *  @param st Stats to fill: samples and ratios, min and max limbs.
+ */
+void bigints_sample(bigint_array b, bigint_order order, sort_stats* st)
+{
+  const ptrdiff_t n = b.size;
+  const ptrdiff_t s = n - 1 < adaptive_samples ? n - 1 : adaptive_samples;
+  st->samples = s;
+  st->descent_ratio = st->duplicate_ratio = 0.0;
+  st->min_limbs = st->max_limbs = n ? mpz_size(b.data[0]) : 0;
+  if (s < 1)
+    return;
+
+  mpz_t* sample = malloc(s * sizeof(mpz_t));
+  size_t descents = 0;
+  for (ptrdiff_t k = 0; k != s; ++k) {
+    const ptrdiff_t i = k * (n - 1) / s;
+    descents += bigint_cmp_order(order, b.data[i+1], b.data[i]) < 0;
+    MPZ_SHALLOW_ASSIGN(sample[k], b.data[i]);
+
+    const size_t l = mpz_size(b.data[i]);
+    if (l < st->min_limbs) st->min_limbs = l;
+    if (l > st->max_limbs) st->max_limbs = l;
+  }
+
+  quicksort_mpz_t(sample, sample + s);
+  size_t dups = 0;
+  for (ptrdiff_t k = 1; k < s; ++k)
+    dups += mpz_cmp(sample[k], sample[k-1]) == 0;
+  free(sample);
+
+  st->descent_ratio = (double)descents / s;
+  st->duplicate_ratio = (double)dups / s;
+}
+
+/** @brief Sort with an algorithm chosen from a presortedness sample.
+ *
+ *  Few runs (ascending or descending): natural mergesort, linear on
+ *  presorted input. All values within 64 bits: exact radix fast path.
+ *  Many duplicates: three-way quicksort. Otherwise: radix on key
+ *  prefixes with quicksort of equal-prefix groups.
+ *
+ *  @param b Big integer 'array' (data ptr & size struct).
+ *  @param order Sort order.
+ *  @param st Stats to record the sample, choice and reason in.
+ */
+void bigints_sort_auto(bigint_array b, bigint_order order, sort_stats* st)
+{
+  mpz_t* e = b.data + b.size;
+  bigints_sample(b, order, st);
+
+  if (st->samples && (st->descent_ratio <= adaptive_run_ratio
+                   || st->descent_ratio >= 1 - adaptive_run_ratio)) {
+    st->algorithm = "mergesort";
+    snprintf(st->reason, sizeof st->reason,
+             "descent ratio %.4f: few long runs", st->descent_ratio);
+    perf_begin(PERF_MERGE);
+    ORDER_CALL(order, mergesort_mpz_t, b.data, e);
+    perf_end(PERF_MERGE);
+  }
+  else if (st->max_limbs <= 1 && bigints_fixed_width(b.data, e)) {
+    st->algorithm = "radix fixed-width";
+    snprintf(st->reason, sizeof st->reason, "all values fit 64 bits");
+    ORDER_CALL(order, radixsort_mpz_t, b.data, e, true);
+  }
+  else if (st->duplicate_ratio >= adaptive_dup_ratio) {
+    st->algorithm = "quicksort";
+    snprintf(st->reason, sizeof st->reason,
+             "duplicate ratio %.4f: three-way partition", st->duplicate_ratio);
+    perf_begin(PERF_PARTITION);
+    ORDER_CALL(order, quicksort_mpz_t, b.data, e);
+    perf_end(PERF_PARTITION);
+  }
+  else {
+    st->algorithm = "radix";
+    snprintf(st->reason, sizeof st->reason,
+             "limbs %zu..%zu, duplicate ratio %.4f: prefix radix",
+             st->min_limbs, st->max_limbs, st->duplicate_ratio);
+    ORDER_CALL(order, radixsort_mpz_t, b.data, e, false);
+  }
+}
+
+#endif
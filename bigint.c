@@ -1,30 +1,451 @@
+#define _GNU_SOURCE   // CPU affinity
+
+#include <inttypes.h>
+
+#include "adaptive.h"
 #include "bigint.h"
 #include "command_options.h"
+#include "compact.h"
+#include "heap.h"
 #include "user_interface.h"
 #include "merge.h"
+#include "merge_files.h"
+#include "order.h"
+#include "parallel_sort.h"
+#include "query.h"
 #include "quick.h"
+#include "radix.h"
+#include "shard.h"
+#include "stats.h"
+#include "store.h"
+#include "verify.h"
+
+void bigints_sort(arguments* args, bigint_array b, sort_stats* st);
+
+/** @brief Sort one key range or chunk with the selected algorithm, in
+ *         the given order; for shard workers and sorting threads.
+ */
+void range_sort(bigint_array b, bigint_order order, void* ctx)
+{
+  arguments args = *(arguments*)ctx;
+  args.order = order;
+  sort_stats st = {};
+  bigints_sort(&args, b, &st);
+}
+
+/** @brief Sort on --threads threads, placed by --affinity.
+ */
+void bigints_sort_threaded(arguments* args, bigint_array b, sort_stats* st)
+{
+  perf_begin(PERF_SORT);
+  int nodes;
+  arguments chunk_args = *args;
+  chunk_args.threads = 1;   // each chunk sorted sequentially
+  bigints_sort_parallel(b, args->order, args->threads, args->affinity,
+                        range_sort, &chunk_args, &nodes);
+  st->algorithm = "parallel";
+  const char* algo = get_sort_algo(args);
+  snprintf(st->reason, sizeof st->reason,
+           "%d threads on %d nodes, affinity %s, %.*s runs", args->threads,
+           nodes, affinity_names[args->affinity], (int)strcspn(algo, " "),
+           algo);
+  perf.algorithm = st->algorithm;
+  perf_end(PERF_SORT);
+}
+
+/** @brief Sort bigints in place with the selected algorithm.
+ */
+void bigints_sort(arguments* args, bigint_array b, sort_stats* st)
+{
+  if (args->threads > 1) {
+    bigints_sort_threaded(args, b, st);
+    return;
+  }
+  mpz_t* e = b.data + b.size;
+  perf_begin(PERF_SORT);
+  snprintf(st->reason, sizeof st->reason, "selected by option");
+  switch (args->sort_algo) {
+    case AUTO:      bigints_sort_auto(b, args->order, st);
+                    break;
+    case MERGESORT: perf_begin(PERF_MERGE);
+                    ORDER_CALL(args->order, mergesort_mpz_t, b.data, e);
+                    perf_end(PERF_MERGE);
+                    st->algorithm = "mergesort";
+                    break;
+    case HEAPSORT:  ORDER_CALL(args->order, heapsort_mpz_t, b.data, e);
+                    st->algorithm = "heapsort";
+                    break;
+    default:
+    case QUICKSORT: perf_begin(PERF_PARTITION);
+                    ORDER_CALL(args->order, quicksort_mpz_t, b.data, e);
+                    perf_end(PERF_PARTITION);
+                    st->algorithm = "quicksort";
+                    break;
+  }
+  if (!perf_muted)   // not from sorting threads
+    perf.algorithm = st->algorithm;
+  perf_end(PERF_SORT);
+}
+
+/** @brief Sort a compact array with the selected algorithm.
+ */
+void bigints_sort_compact(arguments* args, bigint_pack* p, sort_stats* st)
+{
+  perf_begin(PERF_SORT);
+  snprintf(st->reason, sizeof st->reason, "selected by option");
+  switch (args->sort_algo) {
+    case AUTO:      bigints_sort_packed_auto(p, args->order, st);
+                    break;
+    case MERGESORT: bigints_sort_packed(p, 'm', args->order);
+                    st->algorithm = "mergesort";
+                    break;
+    case HEAPSORT:  bigints_sort_packed(p, 'h', args->order);
+                    st->algorithm = "heapsort";
+                    break;
+    default:
+    case QUICKSORT: bigints_sort_packed(p, 'q', args->order);
+                    st->algorithm = "quicksort";
+                    break;
+  }
+  perf.algorithm = st->algorithm;
+  perf_end(PERF_SORT);
+}
+
+/** @brief Sort for the text UI, with the algorithm selected there.
+ */
+void ui_sort(arguments* args, bigint_array b)
+{
+  sort_stats st = {};
+  bigints_sort(args, b, &st);
+}
+
+/** @brief Report verify results before and after sort on stderr.
+ *  @return 0 if sorted with checksum unchanged, else -1.
+ */
+int verify_report(bigints_verify_result in, bigints_verify_result out,
+                  uint32_t size)
+{
+  if (out.unsorted >= 0)
+    fprintf(stderr, "verify: FAILED, not sorted at index %td\n", out.unsorted);
+  if (out.hash != in.hash)
+    fprintf(stderr, "verify: FAILED, checksum %016" PRIx64
+                    " after sort, %016" PRIx64 " before\n", out.hash, in.hash);
+  if (out.unsorted >= 0 || out.hash != in.hash)
+    return -1;
+
+  fprintf(stderr, "verify: %u bigints sorted, checksum %016" PRIx64 "\n",
+                  size, out.hash);
+  return 0;
+}
+
+/** @brief Sort, verifying order and checksum if requested.
+ *  @return 0 on success, -1 if verification failed.
+ */
+int bigints_sort_verified(arguments* args, bigint_array b, sort_stats* st)
+{
+  if (!args->verify) {
+    bigints_sort(args, b, st);
+    return 0;
+  }
+  int num_threads = get_num_threads(args);
+  bigints_verify_result in = bigints_verify(b, false, args->order,
+                                            num_threads);
+  bigints_sort(args, b, st);
+  bigints_verify_result out = bigints_verify(b, true, args->order,
+                                             num_threads);
+  return verify_report(in, out, b.size);
+}
+
+/** @brief Read, sort, verify and write in the compact layout.
+ *  @return 0 on success, -1 on read or verify failure.
+ */
+int bigints_run_compact(arguments* args, FILE* cin, sort_stats* st)
+{
+  int num_threads = get_num_threads(args);
+  double t = stats_now();
+  perf_begin(PERF_PARSE);
+  bigint_pack p = bigints_read_packed(cin, args->filename, num_threads);
+  perf_end(PERF_PARSE);
+  st->read_time = stats_now() - t;
+  st->size = p.size;
+  if (!p.offset)
+    return -1;
+  if (p.size == 0) {
+    fprintf(stderr, "No data read from input data file %s\n",
+                    args->filename);
+    bigints_pack_clear(&p);
+    return -1;
+  }
+
+  t = stats_now();
+  int res = 0;
+  if (args->verify) {
+    bigints_verify_result in = bigints_verify_packed(&p, false, args->order,
+                                                     num_threads);
+    bigints_sort_compact(args, &p, st);
+    bigints_verify_result out = bigints_verify_packed(&p, true, args->order,
+                                                      num_threads);
+    res = verify_report(in, out, p.size);
+  }
+  else
+    bigints_sort_compact(args, &p, st);
+  st->sort_time = stats_now() - t;
+
+  if (res == 0) {
+    t = stats_now();
+    perf_begin(PERF_WRITE);
+    bigints_write_packed(stdout, &p, num_threads);
+    fflush(stdout);
+    perf_end(PERF_WRITE);
+    st->write_time = stats_now() - t;
+  }
+  bigints_pack_clear(&p);
+  return res;
+}
+
+/** @brief Sort over worker processes, by --shards or --connect.
+ *  @return 0 on success, -1 on worker or verify failure.
+ */
+int bigints_run_sharded(arguments* args, bigint_array b, sort_stats* st)
+{
+  int num_threads = get_num_threads(args);
+  const char* shard_out = *args->shard_out ? args->shard_out : NULL;
+  const bool verify = args->verify;   // never with shard_out
+  bigints_verify_result in, out;
+  if (verify)
+    in = bigints_verify(b, false, args->order, num_threads);
+
+  int k = args->num_connect ? args->num_connect : args->shards;
+  int res = bigints_sort_sharded(b, k, args->order,
+                                 args->num_connect ? args->connect : NULL,
+                                 shard_out, range_sort, args, stdout, &out,
+                                 num_threads);
+  fflush(stdout);
+  st->algorithm = "sharded";
+  snprintf(st->reason, sizeof st->reason, "%d %s workers", k,
+           args->num_connect ? "tcp" : "local");
+  if (res == 0 && verify)
+    res = verify_report(in, out, b.size);
+  return res;
+}
+
+/** @brief Answer queries from args->query against the sorted bigints.
+ *  @return 0 on success, -1 on open or parse error.
+ */
+int bigints_answer_queries(arguments* args, bigint_array b)
+{
+  const bool cin = !strcmp(args->query, "-");
+  FILE* qf = cin ? stdin : fopen(args->query, "r");
+  if (!qf) {
+    fprintf(stderr, "Failed to open query file %s\n", args->query);
+    return -1;
+  }
+  int num_threads = get_num_threads(args);
+  ptrdiff_t m;
+  bigint_query* q = bigint_queries_read(qf, &m, num_threads);
+  if (!cin)
+    fclose(qf);
+  if (!q)
+    return m < 0 ? -1 : 0;
+
+  bigint_index ix = bigint_index_build(b);
+  bigints_query(&ix, q, m, num_threads);
+  bigint_queries_write(stdout, &ix, q, m, num_threads);
+  bigint_index_clear(&ix);
+  bigint_queries_clear(q, m);
+  return 0;
+}
+
+/** @brief Run --store: add the -f file as a sorted delta, fold deltas
+ *         into the base, answer queries, or list the store.
+ *
+ *  An added delta costs a sort of the new values only; the merge into
+ *  the base then runs in the background, unless --remerge asks for a
+ *  full fold now.
+ *  @return 0 on success, -1 on read, verify or store failure.
+ */
+int bigints_run_store(arguments* args, sort_stats* st)
+{
+  if (args->order != ORDER_ASC) {
+    fprintf(stderr, "store: a store keeps ascending order\n");
+    return -1;
+  }
+  int num_threads = get_num_threads(args);
+  if (*args->filename)
+  {
+    FILE* cin = fopen(args->filename,"r");
+    if (!cin) {
+      fprintf(stderr, "Failed to open input data file %s\n",
+                      args->filename);
+      return -1;
+    }
+    double t = stats_now();
+    perf_begin(PERF_PARSE);
+    bigint_array b = bigints_read(cin, args->filename, num_threads);
+    perf_end(PERF_PARSE);
+    fclose(cin);
+    st->read_time = stats_now() - t;
+    st->size = b.size;
+    if (!b.data)
+      return -1;
+    if (b.size == 0) {
+      fprintf(stderr, "No data read from input data file %s\n",
+                      args->filename);
+      bigints_clear(&b);
+      return -1;
+    }
+    t = stats_now();
+    int res = bigints_sort_verified(args, b, st);
+    st->sort_time = stats_now() - t;
+    t = stats_now();
+    perf_begin(PERF_WRITE);
+    if (res == 0)
+      res = store_insert(args->store, b);
+    perf_end(PERF_WRITE);
+    st->write_time = stats_now() - t;
+    bigints_clear(&b);
+    if (res != 0)
+      return res;
+    if (!args->remerge)
+      store_merge_background(args->store);
+  }
+  if (args->remerge && store_merge(args->store, true) != 0)
+    return -1;
+
+  if (*args->query)
+  {
+    double t = stats_now();
+    bigint_array b = store_read(args->store);
+    if (!b.data)
+      return -1;
+    int res = bigints_answer_queries(args, b);
+    fflush(stdout);
+    bigints_clear(&b);
+    st->query_time = stats_now() - t;
+    return res;
+  }
+  if (!*args->filename && !args->remerge)
+  {
+    double t = stats_now();
+    setvbuf(stdout, NULL, _IOFBF, store_buffer_size);
+    int64_t n = store_list(args->store, stdout, num_threads);
+    fflush(stdout);
+    st->write_time = stats_now() - t;
+    if (n < 0)
+      return -1;
+    st->size = n;
+  }
+  return 0;
+}
 
 int main(int argc,  char *argv[])
 {
   arguments args = default_args();
   argp_parse(&argp, argc, argv, 0, 0, &args);
 
+  if (*args.serve)
+    return shard_serve(args.serve, *args.shard_out ? args.shard_out : NULL,
+                       range_sort, &args, get_num_threads(&args));
+
+  if (args.perf && !perf_open())
+    fprintf(stderr, "perf: counters unavailable, %s\n", perf.error);
+
+  if (args.merge) {
+    sort_stats stats = { .algorithm = "merge",
+                         .order = order_names[args.order] };
+    perf.algorithm = stats.algorithm;
+    setvbuf(stdout, NULL, _IOFBF, merge_files_buffer_size);
+    double t = stats_now();
+    int64_t n = bigints_merge_files(stdout, args.inputs, args.num_inputs,
+                                    args.order, get_num_threads(&args));
+    fflush(stdout);
+    stats.sort_time = stats_now() - t;
+    if (n < 0)
+      return -1;
+    stats.size = n;
+    if (args.stats)
+      stats_print(stderr, &stats);
+    return 0;
+  }
+
+  if (*args.store) {
+    sort_stats stats = { .order = order_names[args.order] };
+    int res = bigints_run_store(&args, &stats);
+    if (res == 0 && args.stats)
+      stats_print(stderr, &stats);
+    return res;
+  }
+
+  if (*args.query && args.order != ORDER_ASC) {
+    fprintf(stderr, "query: queries need ascending order\n");
+    return -1;
+  }
+
   FILE* cin = fopen(args.filename,"r");
   if (!cin) {
-    printf("Failed to open input data file %s\n",args.filename);
+    fprintf(stderr, "Failed to open input data file %s\n",
+                    args.filename);
     return -1;
   }
 
-  bigint_array bigints __attribute__((cleanup (bigints_clear)))
-                       = bigints_read(cin);
+  sort_stats stats = { .order = order_names[args.order] };
+
+  if (args.compact) {
+    int res = bigints_run_compact(&args, cin, &stats);
+    if (res == 0 && args.stats)
+      stats_print(stderr, &stats);
+    return res;
+  }
 
-  //quicksort_mpz_t(bigints.data, bigints.data+bigints.size);
+  double t = stats_now();
+  perf_begin(PERF_PARSE);
+  bigint_array bigints __attribute__((cleanup (bigints_clear)))
+                       = bigints_read(cin, args.filename,
+                                      get_num_threads(&args));
+  perf_end(PERF_PARSE);
+  stats.read_time = stats_now() - t;
+  stats.size = bigints.size;
 
+  if (!bigints.data)
+    return -1;
   if (bigints.size == 0) {
-    printf("No data read from input data file %s\n",args.filename);
+    fprintf(stderr, "No data read from input data file %s\n",
+                    args.filename);
     return -1;
   }
   if (args.interactive)
-    ui_loop(&args,bigints);
+    ui_loop(&args,bigints,ui_sort);
+
+  if (args.shards || args.num_connect) {
+    t = stats_now();
+    int res = bigints_run_sharded(&args, bigints, &stats);
+    stats.sort_time = stats_now() - t;
+    if (res == 0 && args.stats)
+      stats_print(stderr, &stats);
+    return res;
+  }
+
+  t = stats_now();
+  if (bigints_sort_verified(&args, bigints, &stats) != 0)
+    return -1;
+  stats.sort_time = stats_now() - t;
+
+  t = stats_now();
+  if (*args.query) {
+    if (bigints_answer_queries(&args, bigints) != 0)
+      return -1;
+    fflush(stdout);
+    stats.query_time = stats_now() - t;
+  }
+  else {
+    perf_begin(PERF_WRITE);
+    bigints_write(stdout, bigints, get_num_threads(&args));
+    fflush(stdout);
+    perf_end(PERF_WRITE);
+    stats.write_time = stats_now() - t;
+  }
+
+  if (args.stats)
+    stats_print(stderr, &stats);
 
 }
@@ -1,12 +1,16 @@
 #ifndef BIGINT_H
 #define BIGINT_H 1
 
+#include <ctype.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <gmp.h>
 
+#include "convert.h"
+
 #define TOSTR(x) #x
 #define STR(x) TOSTR(x)
 
@@ -21,6 +25,13 @@
 
 typedef mpz_t bigint;
 
+// bigint_fscan result when out of memory, apart from EOF and bad tokens
+#define bigint_fscan_nomem (-2)
+
+// Ascending order compare and struct copy for the sort and merge macros
+#define MPZ_LESS(a,b) (mpz_cmp(a,b) < 0)
+#define MPZ_SHALLOW_ASSIGN(a,b) *a=*b
+
 const char* bigint_info = "GNU multi-precision lib GMP v" GMP_VER_STR;
 
 typedef struct
@@ -39,15 +50,76 @@ void bigints_clear(bigint_array* b)
   b->size = 0;
 }
 
-bigint_array bigints_read(FILE* bigint_file)
+/** @brief Read one whitespace separated decimal bigint from a stream.
+ *
+ *  Replaces gmp_fscanf "%Zd" so that numbers with millions of digits
+ *  can be converted divide-and-conquer on multiple threads.
+ *
+ *  @param f Input stream.
+ *  @param b Initialized bigint to read into.
+ *  @param buf Token buffer, malloc'd, grown as required; may be NULL.
+ *  @param cap Capacity of token buffer.
+ *  @param num_threads Number of threads allowed for conversion.
+ *  @return 1 if a bigint was read, EOF at end, 0 on a bad token,
+ *          bigint_fscan_nomem if the token buffer cannot grow.
+ */
+int bigint_fscan(FILE* f, bigint b, char** buf, size_t* cap, int num_threads)
+{
+  int c;
+  while ((c = getc(f)) != EOF && isspace(c))
+    ;
+  if (c == EOF)
+    return EOF;
+
+  size_t len = 0;
+  for (; c != EOF && !isspace(c); c = getc(f)) {
+    if (len + 1 >= *cap) {
+      size_t n = *cap ? 2 * *cap : 256;
+      char* p = realloc(*buf, n);
+      if (!p)
+        return bigint_fscan_nomem;
+      *buf = p;
+      *cap = n;
+    }
+    (*buf)[len++] = c;
+  }
+  (*buf)[len] = '\0';
+  return bigint_set_str(b, *buf, 10, num_threads) == 0;
+}
+
+/** @brief What went wrong, for a bigint_fscan result other than 1 or EOF.
+ */
+const char* bigint_fscan_error(int r)
+{
+  return r == bigint_fscan_nomem ? "out of memory reading number"
+                                 : "bad number";
+}
+
+/** @brief Read whitespace separated decimal bigints to end of file.
+ *
+ *  A bad token fails the whole read, reported on stderr with its
+ *  number, so that truncated input is never sorted as if complete.
+ *
+ *  @param bigint_file Input stream.
+ *  @param filename Input name, for error reports.
+ *  @param num_threads Number of threads allowed for conversion.
+ *  @return Array; data is NULL on error, non-NULL for an empty file.
+ */
+bigint_array bigints_read(FILE* bigint_file, const char* filename,
+                          int num_threads)
 {
   bigint_array bigints = {};
 
   if (bigint_file)
   {
     bigints.data = calloc(BIGINT_PREALLOC_SIZE, sizeof(bigint));
+    char* buf = NULL;
+    size_t cap = 0;
+    int r;
 
-    while (gmp_fscanf(bigint_file, "%Zd", bigints.data[bigints.size]) != EOF)
+    mpz_init(bigints.data[0]);
+    while ((r = bigint_fscan(bigint_file, bigints.data[bigints.size],
+                             &buf, &cap, num_threads)) == 1)
     {
       bigints.size++;
       if ( (bigints.size & (bigints.size-1)) == 0
@@ -55,23 +127,167 @@ bigint_array bigints_read(FILE* bigint_file)
         void* p = realloc(bigints.data, 2 * bigints.size * sizeof(bigint));
         if (p)
           bigints.data = p;
-        else
+        else {
           bigints_clear(&bigints);
+          break;
+        }
       }
+      mpz_init(bigints.data[bigints.size]);
     }
+    if (bigints.data)
+      mpz_clear(bigints.data[bigints.size]);
+    if (bigints.data && r != EOF) {
+      fprintf(stderr, "read: %s %u in input file %s\n",
+                      bigint_fscan_error(r), bigints.size + 1, filename);
+      bigints_clear(&bigints);
+    }
+    free(buf);
   }
   return bigints;
 }
 
+/** @brief Write one bigint in decimal, as gmp_fprintf "%Zd".
+ *
+ *  Numbers of convert_parallel_digits or more are converted
+ *  divide-and-conquer when num_threads allows more than one thread.
+ */
+int bigint_fprint(FILE* fs, const bigint b, int num_threads)
+{
+  if (num_threads < 2 || mpz_sizeinbase(b, 10) < convert_parallel_digits)
+    return gmp_fprintf(fs, "%Zd", b);
 
+  char* s = bigint_get_str(b, 10, num_threads);
+  int n = s ? fputs(s, fs) : EOF;
+  free(s);
+  return n;
+}
 
-void bigints_write(FILE* fs, bigint_array b)
+/** @brief Write bigints in decimal, one per line, as read by bigints_read.
+ */
+void bigints_write(FILE* fs, bigint_array b, int num_threads)
 {
   for (int i = 0; i != b.size; ++i) {
-    gmp_fprintf(fs,"%Zx,",b.data[i]);
+    bigint_fprint(fs, b.data[i], num_threads);
+    fputc('\n', fs);
   }
 }
 
+/** @brief Big-endian integers for the raw binary format.
+ */
+bool raw_write_u32(FILE* f, uint32_t v)
+{
+  unsigned char b[4] = { v >> 24, v >> 16, v >> 8, v };
+  return fwrite(b, 1, 4, f) == 4;
+}
+
+bool raw_write_u64(FILE* f, uint64_t v)
+{
+  return raw_write_u32(f, v >> 32) && raw_write_u32(f, v);
+}
+
+bool raw_read_u32(FILE* f, uint32_t* v)
+{
+  unsigned char b[4];
+  if (fread(b, 1, 4, f) != 4)
+    return false;
+  *v = (uint32_t)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+  return true;
+}
+
+bool raw_read_u64(FILE* f, uint64_t* v)
+{
+  uint32_t hi, lo;
+  if (!raw_read_u32(f, &hi) || !raw_read_u32(f, &lo))
+    return false;
+  *v = (uint64_t)hi << 32 | lo;
+  return true;
+}
+
+/** @brief Write bigints in the raw binary format: u64 big-endian count
+ *         then each value as mpz_out_raw, portable across hosts.
+ */
+bool bigints_write_raw(FILE* fs, bigint_array b)
+{
+  bool ok = raw_write_u64(fs, b.size);
+  for (uint32_t i = 0; ok && i != b.size; ++i)
+    ok = mpz_out_raw(fs, b.data[i]) != 0;
+  return ok;
+}
+
+/** @brief Read bigints in the raw binary format.
+ *
+ *  The array grows as records arrive rather than by the count up
+ *  front, so a bad or hostile count costs no more memory than the
+ *  data actually sent.
+ *
+ *  @return Array; data is NULL on error, non-NULL for an empty array.
+ */
+bigint_array bigints_read_raw(FILE* fs)
+{
+  bigint_array b = {};
+  uint64_t n;
+  if (!raw_read_u64(fs, &n) || n > UINT32_MAX)
+    return b;
+  uint64_t cap = n < BIGINT_PREALLOC_SIZE ? n : BIGINT_PREALLOC_SIZE;
+  b.data = calloc(cap + 1, sizeof(bigint));
+  if (!b.data)
+    return b;
+  for (; b.size != n; ++b.size) {
+    if (b.size == cap) {
+      cap = 2 * cap < n ? 2 * cap : n;
+      void* p = realloc(b.data, (cap + 1) * sizeof(bigint));
+      if (!p) {
+        bigints_clear(&b);
+        break;
+      }
+      b.data = p;
+    }
+    mpz_init(b.data[b.size]);
+    if (!mpz_inp_raw(b.data[b.size], fs)) {
+      ++b.size;
+      bigints_clear(&b);
+      break;
+    }
+  }
+  return b;
+}
+
+/** @brief Order-preserving 64-bit key prefix of a bigint, given as
+ *         signed limb count and limbs.
+ *
+ *  a < b implies prefix(a) <= prefix(b), so prefixes can be sorted or
+ *  searched as plain integers with mpz_cmp only to break ties. Layout:
+ *  sign bit (set for >= 0), 22-bit bit length, then the 41 bits that
+ *  follow the leading one bit; the low 63 bits are inverted for
+ *  negative values. Bit lengths from 2^22-1 saturate, keeping no bits.
+ */
+uint64_t limbs_prefix(mp_size_t size, const mp_limb_t* d)
+{
+  _Static_assert(GMP_NUMB_BITS == 64, "limbs_prefix assumes 64-bit limbs");
+  const uint64_t sign = UINT64_C(1) << 63;
+  const size_t n = size < 0 ? -size : size;
+  uint64_t k = 0;
+  if (n != 0) {
+    const uint64_t hi = d[n - 1];
+    const int lz = __builtin_clzll(hi);
+    const uint64_t bits = (uint64_t)n * 64 - lz;
+    if (bits >= (1 << 22) - 1)
+      k = UINT64_C(0x3fffff) << 41;
+    else {
+      uint64_t top = hi << lz;
+      if (lz && n > 1)
+        top |= (uint64_t)d[n - 2] >> (64 - lz);
+      k = bits << 41 | top << 1 >> 23;
+    }
+  }
+  return size < 0 ? ~k & ~sign : k | sign;
+}
+
+uint64_t bigint_prefix(const bigint b)
+{
+  return limbs_prefix(b->_mp_size, mpz_limbs_read(b));
+}
+
 #undef BIGINT_PREALLOC_SIZE
 #undef GMP_VER_STR
 #undef STR
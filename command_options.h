@@ -5,6 +5,10 @@
 #include <argp.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "order.h"
+#include "topology.h"
 
 const char *argp_program_version = "bigint_sort 1.0";
 
@@ -12,7 +16,7 @@ const char *argp_program_bug_address = "wjwray@gmail.com";
 
 static char doc[] = "bigint_sort: Sort a long list of massive integers.";
 
-static char args_doc[] = "Big sort";
+static char args_doc[] = "[FILE...]";
 
 static struct argp_option options[] = {
     { "interactive", 'i', 0, 0, "Interactive mode with text UI."},
@@ -20,7 +24,23 @@ static struct argp_option options[] = {
     { "quicksort", 'q', 0, 0, "Set sort algo to quicksort."},
     { "mergesort", 'm', 0, 0, "Set sort algo to mergesort."},
     { "heapsort", 'h', 0, 0, "Set sort algo to heapsort."},
-    { "pthreads", 'h', 0, 0, "Switch threading On/oFf."},
+    { "auto", 'a', 0, 0, "Choose sort algo by sampling the input."},
+    { "pthreads", 'p', 0, 0, "Switch threading On/oFf."},
+    { "verify", 'v', 0, 0, "Verify sorted order and checksum after sort."},
+    { "merge", 'M', 0, 0, "Merge pre-sorted input FILEs to stdout."},
+    { "stats", 's', 0, 0, "Print sort statistics as JSON to stderr."},
+    { "query", 'Q', "filename", 0, "Answer queries from file (- for stdin)."},
+    { "compact", 'c', 0, 0, "Sort in compact packed-record layout."},
+    { "shards", 'S', "N", 0, "Sort by key range over N forked worker processes."},
+    { "connect", 'C', "host:port", 0, "Send a key range to this worker; repeatable."},
+    { "serve", 'W', "[host:]port", 0, "Run as a TCP sort worker."},
+    { "shard-out", 'O', "prefix", 0, "Workers write ranges to prefix.N; --serve takes its own."},
+    { "perf", 'P', 0, 0, "Count cycles, instructions and misses per phase."},
+    { "order", 'o', "asc|desc|abs|bits", 0, "Sort order; abs and bits tie on value."},
+    { "threads", 't', "N", 0, "Sort on N threads; sets the thread count for -p paths."},
+    { "affinity", 'A', "none|compact|scatter", 0, "Pin threads; node-local chunks and merges."},
+    { "store", 'D', "dir", 0, "Sorted store: -f adds, -Q queries, else lists."},
+    { "remerge", 'R', 0, 0, "Fold all store deltas into the base now."},
     { 0 } 
 };
 
@@ -28,17 +48,54 @@ static struct argp_option options[] = {
 //
 typedef struct {
   char filename[64];
-  enum { QUICKSORT = 'q', MERGESORT = 'm', HEAPSORT = 'h' } sort_algo;
+  char query[64];
+  char serve[64];
+  char shard_out[64];
+  char store[64];
+  enum { QUICKSORT = 'q', MERGESORT = 'm', HEAPSORT = 'h',
+         AUTO = 'a' } sort_algo;
+  bigint_order order;
   bool interactive;
   bool pthreaded;
+  bool verify;
+  bool merge;
+  bool stats;
+  bool compact;
+  bool perf;
+  bool remerge;
+  char** inputs;
+  int num_inputs;
+  int shards;
+  int threads;
+  affinity_mode affinity;
+  char* connect[64];
+  int num_connect;
 } arguments;
 
 arguments default_args() {
   arguments args = {
     .filename = {},
+    .query = {},
+    .serve = {},
+    .shard_out = {},
+    .store = {},
     .sort_algo = QUICKSORT,
+    .order = ORDER_ASC,
     .interactive = false,
-    .pthreaded = false
+    .pthreaded = false,
+    .verify = false,
+    .merge = false,
+    .stats = false,
+    .compact = false,
+    .perf = false,
+    .remerge = false,
+    .inputs = NULL,
+    .num_inputs = 0,
+    .shards = 0,
+    .threads = 0,
+    .affinity = AFFINITY_NONE,
+    .connect = {},
+    .num_connect = 0
   };
   return args;
 }
@@ -47,12 +104,22 @@ const char* get_filename(arguments* a) {
   return a->filename;
 }
 
+/** @brief Number of threads the parallel code paths may use.
+ */
+int get_num_threads(arguments* a) {
+  if (a->threads)
+    return a->threads;
+  long n = a->pthreaded ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  return n > 1 ? (int)n : 1;
+}
+
 const char* set_sort_algo(arguments* a, char c) {
   switch(a->sort_algo = c) {
     default:
     case QUICKSORT: return "quicksort";
     case MERGESORT: return "mergesort";
     case HEAPSORT:  return "heapsort ";
+    case AUTO:      return "auto     ";
   }
 }
 
@@ -69,11 +136,92 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
               break;
     case 'q':
     case 'm':
-    case 'h': set_sort_algo(args,key);
+    case 'h':
+    case 'a': set_sort_algo(args,key);
               break;
     case 'p': args->pthreaded = ! args->pthreaded;
               break;
-    case ARGP_KEY_ARG: return 0;
+    case 'v': args->verify = true;
+              break;
+    case 'M': args->merge = true;
+              break;
+    case 's': args->stats = true;
+              break;
+    case 'c': args->compact = true;
+              break;
+    case 'P': args->perf = true;
+              break;
+    case 'R': args->remerge = true;
+              break;
+    case 'o': { int o = order_parse(arg);
+                if (o < 0)
+                  argp_error(state, "order must be asc, desc, abs or bits");
+                args->order = o; }
+              break;
+    case 'S': args->shards = atoi(arg);
+              if (args->shards < 1 || args->shards > 1024)
+                argp_error(state, "shards must be 1 to 1024");
+              break;
+    case 't': args->threads = atoi(arg);
+              if (args->threads < 1 || args->threads > 1024)
+                argp_error(state, "threads must be 1 to 1024");
+              break;
+    case 'A': { int m = affinity_parse(arg);
+                if (m < 0)
+                  argp_error(state, "affinity must be none, compact or scatter");
+                args->affinity = m; }
+              break;
+    case 'C': if (args->num_connect == 64)
+                argp_error(state, "too many workers");
+              args->connect[args->num_connect++] = arg;
+              break;
+    case 'W': if (strlen(arg) < 64) strcpy(args->serve, arg);
+              break;
+    case 'O': if (strlen(arg) < 64) strcpy(args->shard_out, arg);
+              break;
+    case 'Q': if (strlen(arg) < 64) strcpy(args->query, arg);
+              break;
+    case 'D': if (strlen(arg) < 64) strcpy(args->store, arg);
+              break;
+    case ARGP_KEY_ARGS:
+              args->inputs = state->argv + state->next;
+              args->num_inputs = state->argc - state->next;
+              break;
+    case ARGP_KEY_END:
+              if (args->num_inputs && !args->merge)
+                argp_error(state, "FILEs are only taken with --merge");
+              if (args->merge && !args->num_inputs)
+                argp_error(state, "--merge needs FILEs to merge");
+              if (args->merge && (*args->filename || *args->query
+                                  || *args->store || args->shards
+                                  || args->num_connect || args->compact
+                                  || args->interactive || args->verify))
+                argp_error(state, "--merge takes only FILEs; drop --file, "
+                                  "--query, --store, --shards, --connect, "
+                                  "--compact, --interactive and --verify");
+              if (args->shards || args->num_connect) {
+                if (args->compact)
+                  argp_error(state, "--compact does not apply to --shards "
+                                    "or --connect");
+                if (*args->query)
+                  argp_error(state, "--query does not apply to --shards "
+                                    "or --connect");
+                if (args->verify && *args->shard_out)
+                  argp_error(state, "--verify needs ranges streamed back, "
+                                    "not --shard-out");
+              }
+              else if (*args->shard_out && !*args->serve)
+                argp_error(state, "--shard-out needs --shards, --connect "
+                                  "or --serve");
+              if (args->compact) {
+                if (*args->query || args->interactive || *args->store)
+                  argp_error(state, "--compact does not apply to --query, "
+                                    "--interactive or --store");
+                if (args->threads > 1 || args->pthreaded)
+                  argp_error(state, "--compact sorts on one thread; drop "
+                                    "--threads and --pthreads");
+              }
+              break;
     default: return ARGP_ERR_UNKNOWN;
   }   
   return 0;
@@ -0,0 +1,318 @@
+#ifndef COMPACT_H
+#define COMPACT_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gmp.h>
+
+#include "adaptive.h"
+#include "bigint.h"
+#include "heap.h"
+#include "merge.h"
+#include "order.h"
+#include "perf.h"
+#include "quick.h"
+#include "radix.h"
+
+// Initial arena size, in limbs, and offset count
+#define PACK_PREALLOC_LIMBS (1 << 16)
+#define PACK_PREALLOC_SIZE 1024
+
+/** @brief Compact bigint array: packed records plus 32-bit offsets.
+ *
+ *  Each record is one header limb holding the signed limb count, as
+ *  mpz _mp_size, followed by the limbs; records are packed back to back
+ *  in one arena. Sorts permute only the offsets, in limbs, so the arena
+ *  can hold up to 2^32 limbs. Costs 12 bytes plus 8 per limb per value,
+ *  against 16 bytes of mpz_t plus a malloc block for the limbs.
+ */
+typedef struct
+{
+  uint32_t size;
+  uint32_t* offset;
+  mp_limb_t* arena;
+  size_t used;          // arena limbs in use
+  size_t cap;           // arena limbs allocated
+
+} bigint_pack;
+
+typedef uint32_t pack_off;
+
+/** @brief Compare two records, as mpz_cmp.
+ */
+static inline int pack_cmp(const mp_limb_t* a, const mp_limb_t* b)
+{
+  return limbs_cmp((mp_size_t)a[0], a + 1, (mp_size_t)b[0], b + 1);
+}
+
+static inline int pack_cmp_abs(const mp_limb_t* a, const mp_limb_t* b)
+{
+  return limbs_cmp_abs((mp_size_t)a[0], a + 1, (mp_size_t)b[0], b + 1);
+}
+
+static inline int pack_cmp_bits(const mp_limb_t* a, const mp_limb_t* b)
+{
+  return limbs_cmp_bits((mp_size_t)a[0], a + 1, (mp_size_t)b[0], b + 1);
+}
+
+/** @brief Compare two records in the given order, as bigint_cmp_order.
+ */
+static inline int pack_cmp_order(bigint_order order,
+                                 const mp_limb_t* a, const mp_limb_t* b)
+{
+  switch (order) {
+    case ORDER_DESC: return pack_cmp(b, a);
+    case ORDER_ABS:  return pack_cmp_abs(a, b);
+    case ORDER_BITS: return pack_cmp_bits(a, b);
+    default:         return pack_cmp(a, b);
+  }
+}
+
+/** @brief Number of limbs in a record.
+ */
+static inline size_t pack_limbs(const mp_limb_t* r)
+{
+  const mp_size_t s = (mp_size_t)r[0];
+  return s < 0 ? -s : s;
+}
+
+/** @brief Read-only mpz_t view of a record, no copy.
+ */
+static inline mpz_srcptr pack_view(mpz_t v, const mp_limb_t* r)
+{
+  return mpz_roinit_n(v, r + 1, (mp_size_t)r[0]);
+}
+
+// Arena the offset compare resolves against; set around each sort
+static __thread const mp_limb_t* pack_arena;
+
+#define PACK_LESS(a,b) (pack_cmp(pack_arena + (a), pack_arena + (b)) < 0)
+#define PACK_GREATER(a,b) (pack_cmp(pack_arena + (a), pack_arena + (b)) > 0)
+#define PACK_ABS_LESS(a,b) \
+  (pack_cmp_abs(pack_arena + (a), pack_arena + (b)) < 0)
+#define PACK_BITS_LESS(a,b) \
+  (pack_cmp_bits(pack_arena + (a), pack_arena + (b)) < 0)
+#define VALUE_SWAP(a,b) { __typeof__(a) t_ = (a); (a) = (b); (b) = t_; }
+
+// Offset type names for the per-order instantiations, as mpz_t_desc etc.
+typedef pack_off pack_off_desc;
+typedef pack_off pack_off_abs;
+typedef pack_off pack_off_bits;
+
+PARTITION(pack_off,PACK_LESS,VALUE_SWAP)
+PARTITION(pack_off_desc,PACK_GREATER,VALUE_SWAP)
+PARTITION(pack_off_abs,PACK_ABS_LESS,VALUE_SWAP)
+PARTITION(pack_off_bits,PACK_BITS_LESS,VALUE_SWAP)
+HEAPSORT_ALL(pack_off,PACK_LESS,ASSIGN)
+HEAPSORT_ALL(pack_off_desc,PACK_GREATER,ASSIGN)
+HEAPSORT_ALL(pack_off_abs,PACK_ABS_LESS,ASSIGN)
+HEAPSORT_ALL(pack_off_bits,PACK_BITS_LESS,ASSIGN)
+QUICKSORT(pack_off,PACK_LESS,ASSIGN)
+QUICKSORT(pack_off_desc,PACK_GREATER,ASSIGN)
+QUICKSORT(pack_off_abs,PACK_ABS_LESS,ASSIGN)
+QUICKSORT(pack_off_bits,PACK_BITS_LESS,ASSIGN)
+MERGE(pack_off,PACK_LESS,ASSIGN)
+MERGE(pack_off_desc,PACK_GREATER,ASSIGN)
+MERGE(pack_off_abs,PACK_ABS_LESS,ASSIGN)
+MERGE(pack_off_bits,PACK_BITS_LESS,ASSIGN)
+NATURAL_MERGESORT(pack_off,PACK_LESS,ASSIGN)
+NATURAL_MERGESORT(pack_off_desc,PACK_GREATER,ASSIGN)
+NATURAL_MERGESORT(pack_off_abs,PACK_ABS_LESS,ASSIGN)
+NATURAL_MERGESORT(pack_off_bits,PACK_BITS_LESS,ASSIGN)
+
+void bigints_pack_clear(bigint_pack* p)
+{
+  free(p->offset);
+  free(p->arena);
+  *p = (bigint_pack){};
+}
+
+/** @brief Append a value as a record.
+ *  @return false if out of memory or offset range.
+ */
+bool bigints_pack_push(bigint_pack* p, const bigint b)
+{
+  const size_t n = mpz_size(b);
+  if (p->used + n + 1 > p->cap) {
+    size_t cap = p->cap ? 2 * p->cap : PACK_PREALLOC_LIMBS;
+    while (cap < p->used + n + 1)
+      cap *= 2;
+    void* a = realloc(p->arena, cap * sizeof(mp_limb_t));
+    if (!a)
+      return false;
+    p->arena = a;
+    p->cap = cap;
+  }
+  if (p->used > UINT32_MAX)
+    return false;
+  if ((p->size & (p->size - 1)) == 0 && p->size >= PACK_PREALLOC_SIZE) {
+    void* o = realloc(p->offset, 2 * p->size * sizeof(pack_off));
+    if (!o)
+      return false;
+    p->offset = o;
+  }
+  p->offset[p->size++] = p->used;
+  p->arena[p->used] = (mp_limb_t)b->_mp_size;
+  memcpy(p->arena + p->used + 1, mpz_limbs_read(b), n * sizeof(mp_limb_t));
+  p->used += n + 1;
+  return true;
+}
+
+/** @brief Read bigints, as bigints_read, into a compact array.
+ *  @return Array; offset is NULL on error.
+ */
+bigint_pack bigints_read_packed(FILE* bigint_file, const char* filename,
+                                int num_threads)
+{
+  bigint_pack p = {};
+  if (!bigint_file)
+    return p;
+
+  p.offset = malloc(PACK_PREALLOC_SIZE * sizeof(pack_off));
+  char* buf = NULL;
+  size_t cap = 0;
+  mpz_t b;
+  mpz_init(b);
+  int r;
+  while ((r = bigint_fscan(bigint_file, b, &buf, &cap, num_threads)) == 1)
+    if (!bigints_pack_push(&p, b)) {
+      bigints_pack_clear(&p);
+      break;
+    }
+  if (p.offset && r != EOF) {
+    fprintf(stderr, "read: %s %u in input file %s\n",
+                    bigint_fscan_error(r), p.size + 1, filename);
+    bigints_pack_clear(&p);
+  }
+  mpz_clear(b);
+  free(buf);
+
+  if (p.cap > p.used) {
+    void* a = realloc(p.arena, (p.used ? p.used : 1) * sizeof(mp_limb_t));
+    if (a) {
+      p.arena = a;
+      p.cap = p.used;
+    }
+  }
+  return p;
+}
+
+/** @brief Write records in offset order, as bigints_write.
+ */
+void bigints_write_packed(FILE* fs, const bigint_pack* p, int num_threads)
+{
+  mpz_t v;
+  for (uint32_t i = 0; i != p->size; ++i) {
+    bigint_fprint(fs, pack_view(v, p->arena + p->offset[i]), num_threads);
+    fputc('\n', fs);
+  }
+}
+
+/** @brief Radix sort offsets on record key prefixes, for given
+ *         offset type; equal-prefix groups are finished with quicksort.
+ *
+ *  The offsets themselves are the payload of the key sort, so no index
+ *  or permutation array is needed.
+ */
+#define RADIXSORT_PACK(type,prefix) \
+void radixsort_##type(const bigint_pack* p) { \
+  const ptrdiff_t n = p->size; \
+  if (n < 2) \
+    return; \
+  uint64_t* keys = malloc(n * sizeof(uint64_t)); \
+  perf_begin(PERF_KEYS); \
+  for (ptrdiff_t i = 0; i != n; ++i) { \
+    const mp_limb_t* r = p->arena + p->offset[i]; \
+    keys[i] = prefix((mp_size_t)r[0], r + 1); \
+  } \
+  perf_end(PERF_KEYS); \
+  radix_sort_keys(keys, p->offset, n); \
+  perf_begin(PERF_PARTITION); \
+  for (ptrdiff_t i = 0, j; i != n; i = j) { \
+    for (j = i + 1; j != n && keys[j] == keys[i]; ++j) \
+      ; \
+    if (j - i > 1) \
+      quicksort_##type(p->offset + i, p->offset + j); \
+  } \
+  perf_end(PERF_PARTITION); \
+  free(keys); \
+}
+
+RADIXSORT_PACK(pack_off,limbs_prefix)
+RADIXSORT_PACK(pack_off_desc,limbs_prefix_desc)
+RADIXSORT_PACK(pack_off_abs,limbs_prefix_abs)
+RADIXSORT_PACK(pack_off_bits,limbs_prefix_bits)
+
+/** @brief Sort a compact array by permuting its offsets.
+ *  @param algo Sort algorithm, 'q' quicksort, 'm' mergesort,
+ *              'h' heapsort or 'r' radix on key prefixes.
+ *  @param order Sort order.
+ */
+void bigints_sort_packed(bigint_pack* p, char algo, bigint_order order)
+{
+  pack_off* b = p->offset;
+  pack_off* e = p->offset + p->size;
+  pack_arena = p->arena;
+  switch (algo) {
+    case 'm': perf_begin(PERF_MERGE);
+              ORDER_CALL(order, mergesort_pack_off, b, e);
+              perf_end(PERF_MERGE);
+              break;
+    case 'h': ORDER_CALL(order, heapsort_pack_off, b, e);
+              break;
+    case 'r': ORDER_CALL(order, radixsort_pack_off, p);
+              break;
+    default:
+    case 'q': perf_begin(PERF_PARTITION);
+              ORDER_CALL(order, quicksort_pack_off, b, e);
+              perf_end(PERF_PARTITION);
+              break;
+  }
+  pack_arena = NULL;
+}
+
+/** @brief Sort a compact array, natural mergesort if a sample finds
+ *         few runs, else radix on key prefixes; as bigints_sort_auto.
+ */
+void bigints_sort_packed_auto(bigint_pack* p, bigint_order order,
+                              sort_stats* st)
+{
+  const ptrdiff_t n = p->size;
+  const ptrdiff_t s = n - 1 < adaptive_samples ? n - 1 : adaptive_samples;
+  size_t descents = 0;
+  st->min_limbs = st->max_limbs = n ? pack_limbs(p->arena) : 0;
+  for (ptrdiff_t k = 0; k < s; ++k) {
+    const ptrdiff_t i = k * (n - 1) / s;
+    const mp_limb_t* r = p->arena + p->offset[i];
+    descents += pack_cmp_order(order, p->arena + p->offset[i+1], r) < 0;
+    const size_t l = pack_limbs(r);
+    if (l < st->min_limbs) st->min_limbs = l;
+    if (l > st->max_limbs) st->max_limbs = l;
+  }
+  st->samples = s > 0 ? s : 0;
+  st->descent_ratio = s > 0 ? (double)descents / s : 0.0;
+
+  if (s > 0 && (st->descent_ratio <= adaptive_run_ratio
+             || st->descent_ratio >= 1 - adaptive_run_ratio)) {
+    st->algorithm = "mergesort";
+    snprintf(st->reason, sizeof st->reason,
+             "descent ratio %.4f: few long runs", st->descent_ratio);
+    bigints_sort_packed(p, 'm', order);
+  }
+  else {
+    st->algorithm = "radix";
+    snprintf(st->reason, sizeof st->reason,
+             "descent ratio %.4f: prefix radix", st->descent_ratio);
+    bigints_sort_packed(p, 'r', order);
+  }
+}
+
+#undef PACK_PREALLOC_LIMBS
+#undef PACK_PREALLOC_SIZE
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef CONVERT_H
+#define CONVERT_H 1
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gmp.h>
+
+// Digit count at and above which string <-> limb conversion goes
+// divide-and-conquer; below it GMP's own conversion is used as-is
+#define convert_parallel_digits (1 << 16)
+
+// Leaf size, in digits, of the divide-and-conquer recursion
+#define convert_leaf_digits (1 << 12)
+
+#define convert_max_levels 48
+
+/** @brief Table of powers of the base used to split digit strings.
+ *
+ *  pow[i] = base ^ digits[i], with digits[i] = leaf digits << i,
+ *  so each level squares the one below it.
+ */
+typedef struct
+{
+  int base;
+  int levels;
+  size_t digits[convert_max_levels];
+  mpz_t pow[convert_max_levels];
+
+} convert_powers;
+
+/** @brief Precompute powers of base for strings up to len digits.
+ *  @param p Power table to initialize.
+ *  @param base Number base, 2 to 62 as for mpz_set_str.
+ *  @param len Longest digit string the table will be used to split.
+ */
+void convert_powers_init(convert_powers* p, int base, size_t len)
+{
+  p->base = base;
+  p->levels = 0;
+  for (size_t d = convert_leaf_digits;
+       d < len && p->levels != convert_max_levels; d *= 2)
+  {
+    int i = p->levels++;
+    p->digits[i] = d;
+    mpz_init(p->pow[i]);
+    if (i == 0)
+      mpz_ui_pow_ui(p->pow[i], base, d);
+    else
+      mpz_mul(p->pow[i], p->pow[i-1], p->pow[i-1]);
+  }
+}
+
+void convert_powers_clear(convert_powers* p)
+{
+  for (int i = 0; i != p->levels; ++i)
+    mpz_clear(p->pow[i]);
+  p->levels = 0;
+}
+
+/** @brief Recursion state handed to a helper thread.
+ */
+typedef struct
+{
+  mpz_ptr r;
+  mpz_srcptr x;
+  char* s;
+  size_t len;
+  const convert_powers* p;
+  int level;
+  int num_threads;
+  int res;
+
+} convert_task;
+
+int convert_from_str(mpz_ptr r, const char* s, size_t len,
+                     const convert_powers* p, int level, int num_threads);
+
+void convert_to_str(char* s, size_t len, mpz_srcptr x,
+                    const convert_powers* p, int level, int num_threads);
+
+static void* convert_from_str_task(void* arg)
+{
+  convert_task* t = arg;
+  t->res = convert_from_str(t->r, t->s, t->len, t->p, t->level,
+                            t->num_threads);
+  return NULL;
+}
+
+static void* convert_to_str_task(void* arg)
+{
+  convert_task* t = arg;
+  convert_to_str(t->s, t->len, t->x, t->p, t->level, t->num_threads);
+  return NULL;
+}
+
+/** @brief Run task on a new thread if threads allow, else inline.
+ *  @return true if a thread was started and must be joined.
+ */
+static bool convert_spawn(pthread_t* th, void* (*task)(void*),
+                          convert_task* t, int num_threads)
+{
+  if (num_threads > 1 && pthread_create(th, NULL, task, t) == 0)
+    return true;
+  task(t);
+  return false;
+}
+
+/** @brief Divide-and-conquer digit string to limbs conversion.
+ *
+ *  The high digits and the low digits[level] digits are converted
+ *  concurrently then combined as r = high * pow[level] + low.
+ *
+ *  @param r Result, initialized.
+ *  @param s Digit string, no sign, not necessarily nul terminated.
+ *  @param len Number of digits in s.
+ *  @param p Power table covering len digits.
+ *  @param level Highest power table level to split at.
+ *  @param num_threads Number of threads allowed to work on this part.
+ *  @return 0 on success, -1 if s holds an invalid digit.
+ */
+int convert_from_str(mpz_ptr r, const char* s, size_t len,
+                     const convert_powers* p, int level, int num_threads)
+{
+  while (level >= 0 && p->digits[level] >= len)
+    --level;
+
+  if (level < 0) {
+    char* z = malloc(len + 1);
+    memcpy(z, s, len);
+    z[len] = '\0';
+    int res = mpz_set_str(r, z, p->base);
+    free(z);
+    return res;
+  }
+
+  const size_t lo = p->digits[level];
+  mpz_t hi;
+  mpz_init(hi);
+
+  convert_task t = { hi, NULL, (char*)s, len - lo, p, level - 1,
+                     num_threads / 2, 0 };
+  pthread_t th;
+  bool spawned = convert_spawn(&th, convert_from_str_task, &t, num_threads);
+  int res = convert_from_str(r, s + len - lo, lo, p, level - 1,
+                             num_threads - num_threads / 2);
+  if (spawned)
+    pthread_join(th, NULL);
+
+  if (res == 0 && t.res == 0)
+    mpz_addmul(r, hi, p->pow[level]);
+  else
+    res = -1;
+  mpz_clear(hi);
+  return res;
+}
+
+/** @brief Divide-and-conquer limbs to digit string conversion.
+ *
+ *  Writes exactly len digits, zero padded on the left; x must be
+ *  non-negative and less than base ^ len. No nul is appended.
+ *
+ *  @param s Output buffer of at least len chars.
+ *  @param len Number of digits to write.
+ *  @param x Value to convert.
+ *  @param p Power table covering len digits.
+ *  @param level Highest power table level to split at.
+ *  @param num_threads Number of threads allowed to work on this part.
+ */
+void convert_to_str(char* s, size_t len, mpz_srcptr x,
+                    const convert_powers* p, int level, int num_threads)
+{
+  while (level >= 0 && p->digits[level] >= len)
+    --level;
+
+  if (level < 0) {
+    char* z = malloc(mpz_sizeinbase(x, p->base) + 2);
+    mpz_get_str(z, p->base, x);
+    size_t zn = strlen(z);
+    memset(s, '0', len - zn);
+    memcpy(s + len - zn, z, zn);
+    free(z);
+    return;
+  }
+
+  const size_t lo = p->digits[level];
+  mpz_t q, r;
+  mpz_init(q);
+  mpz_init(r);
+  mpz_tdiv_qr(q, r, x, p->pow[level]);
+
+  convert_task t = { NULL, q, s, len - lo, p, level - 1,
+                     num_threads / 2, 0 };
+  pthread_t th;
+  bool spawned = convert_spawn(&th, convert_to_str_task, &t, num_threads);
+  convert_to_str(s + len - lo, lo, r, p, level - 1,
+                 num_threads - num_threads / 2);
+  if (spawned)
+    pthread_join(th, NULL);
+
+  mpz_clear(q);
+  mpz_clear(r);
+}
+
+/** @brief Value of digit c in base, as mpz_set_str, or -1.
+ */
+static inline int convert_digit(char c, int base)
+{
+  int v = c >= '0' && c <= '9' ? c - '0'
+        : c >= 'A' && c <= 'Z' ? c - 'A' + 10
+        : c >= 'a' && c <= 'z' ? c - 'a' + (base <= 36 ? 10 : 36)
+        : -1;
+  return v < base ? v : -1;
+}
+
+/** @brief Set bigint from a nul terminated string, as mpz_set_str.
+ *
+ *  The string must be one optional sign, '-' or '+', then digits only,
+ *  whichever path converts it; a '+' is skipped, as gmp_fscanf does.
+ *  Strings of convert_parallel_digits or more digits are converted
+ *  divide-and-conquer when num_threads allows more than one thread;
+ *  on one thread GMP's own conversion is faster.
+ *
+ *  @return 0 on success, -1 if the string is not a valid number.
+ */
+int bigint_set_str(mpz_ptr r, const char* s, int base, int num_threads)
+{
+  const bool neg = *s == '-';
+  if (neg || *s == '+')
+    ++s;
+  size_t len = 0;
+  for (; s[len]; ++len)
+    if (convert_digit(s[len], base) < 0)
+      return -1;
+  if (len == 0)
+    return -1;
+
+  int res;
+  if (num_threads < 2 || len < convert_parallel_digits)
+    res = mpz_set_str(r, s, base);
+  else {
+    convert_powers p;
+    convert_powers_init(&p, base, len);
+    res = convert_from_str(r, s, len, &p, p.levels - 1, num_threads);
+    convert_powers_clear(&p);
+  }
+
+  if (neg)
+    mpz_neg(r, r);
+  return res;
+}
+
+/** @brief Convert bigint to a malloc'd nul terminated string.
+ *
+ *  As mpz_get_str, but values of convert_parallel_digits or more
+ *  digits are converted divide-and-conquer when num_threads allows
+ *  more than one thread.
+ *
+ *  @return String to be released with free.
+ */
+char* bigint_get_str(mpz_srcptr x, int base, int num_threads)
+{
+  size_t len = mpz_sizeinbase(x, base);
+  char* s = malloc(len + 2);
+  if (!s || num_threads < 2 || len < convert_parallel_digits)
+    return s ? mpz_get_str(s, base, x) : s;
+
+  char* d = s;
+  if (mpz_sgn(x) < 0)
+    *d++ = '-';
+
+  mpz_t a;
+  mpz_init(a);
+  mpz_abs(a, x);
+
+  convert_powers p;
+  convert_powers_init(&p, base, len);
+  convert_to_str(d, len, a, &p, p.levels - 1, num_threads);
+  convert_powers_clear(&p);
+  mpz_clear(a);
+
+  // mpz_sizeinbase may overestimate by one digit
+  size_t z = 0;
+  while (z + 1 < len && d[z] == '0')
+    ++z;
+  memmove(d, d + z, len - z);
+  d[len - z] = '\0';
+  return s;
+}
+
+#endif
@@ -5,47 +5,89 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define PUSH_HEAP(type,compare) \
-void push_heap(type* b,	ptrdiff_t holeInd, ptrdiff_t topInd, type val) { \
-  ptrdiff_t parent = (holeInd - 1) / 2; \
-  while (holeInd > topInd && compare(*(b + parent), val)) { \
-    *(b + holeInd) = *(b + parent); \
-    holeInd = parent; \
-    parent = (holeInd - 1) / 2; \
+#include <gmp.h>
+
+#include "bigint.h"
+#include "order.h"
+
+/** @brief Sift value v up from hole towards top.
+ *
+ *  Values are passed by pointer, to a copy outside the heap, so that
+ *  array types like mpz_t are handled the same as scalars.
+ */
+#define PUSH_HEAP(type,compare,assign) \
+static void push_heap_##type(type* b, ptrdiff_t hole, ptrdiff_t top, \
+                             type* v) { \
+  ptrdiff_t parent = (hole - 1) / 2; \
+  while (hole > top && compare(b[parent], *v)) { \
+    assign(b[hole], b[parent]); \
+    hole = parent; \
+    parent = (hole - 1) / 2; \
   } \
-  *(b + holeInd) = val; \
+  assign(b[hole], *v); \
 }
 
-#define ADJUST_HEAP(type,compare) \
-void adjust_heap(type* b, ptrdiff_t holeInd, ptrdiff_t len, type val) { \
-  const ptrdiff_t topInd = holeInd; \
-  ptrdiff_t secondChild = holeInd; \
-  while (secondChild < (len - 1) / 2) { \
-    secondChild = 2 * (secondChild + 1); \
-    if (compare(b + secondChild, b + (secondChild - 1))) \
-      secondChild--; \
-    *(b + holeInd) = *(b + secondChild); \
-    holeInd = secondChild; \
+/** @brief Move the hole down to a leaf along larger children, then
+ *         push v up from there (Floyd's bottom-up heap adjust).
+ */
+#define ADJUST_HEAP(type,compare,assign) \
+static void adjust_heap_##type(type* b, ptrdiff_t hole, ptrdiff_t len, \
+                               type* v) { \
+  const ptrdiff_t top = hole; \
+  ptrdiff_t child = hole; \
+  while (child < (len - 1) / 2) { \
+    child = 2 * (child + 1); \
+    if (compare(b[child], b[child - 1])) \
+      child--; \
+    assign(b[hole], b[child]); \
+    hole = child; \
   } \
-  if ((len & 1) == 0 && secondChild == (len - 2) / 2) { \
-    secondChild = 2 * (secondChild + 1); \
-    *(b + holeInd) = *(b + (secondChild - 1)); \
-    holeInd = secondChild - 1; \
+  if ((len & 1) == 0 && child == (len - 2) / 2) { \
+    child = 2 * (child + 1); \
+    assign(b[hole], b[child - 1]); \
+    hole = child - 1; \
   } \
-  push_heap##type(b, holeInd, topInd, val); \
+  push_heap_##type(b, hole, top, v); \
 }
 
-#define MAKE_HEAP(type,compare) \
+#define MAKE_HEAP(type,assign) \
 void make_heap_##type(type* b, type* e) { \
-  if (e - b < 2) return; \
   const ptrdiff_t len = e - b; \
-  ptrdiff_t parent = (len - 2) / 2; \
-  while (true) { \
-    adjust_heap(b, parent, len, *(b + parent)); \
+  if (len < 2) return; \
+  for (ptrdiff_t parent = (len - 2) / 2; ; parent--) { \
+    type v; assign(v, b[parent]); \
+    adjust_heap_##type(b, parent, len, &v); \
     if (parent == 0) \
       return; \
-    parent--; \
   } \
 }
 
-#endif
\ No newline at end of file
+/** @brief Heapsort for given type; needs the heap macros above.
+ *  @param b Begin pointer of input sequence.
+ *  @param e End pointer of input sequence.
+ */
+#define HEAPSORT(type,assign) \
+void heapsort_##type(type* b, type* e) { \
+  make_heap_##type(b, e); \
+  while (e - b > 1) { \
+    --e; \
+    type v; assign(v, *e); \
+    assign(*e, *b); \
+    adjust_heap_##type(b, 0, e - b, &v); \
+  } \
+}
+
+/** @brief All heapsort macros, for given type, compare and assign.
+ */
+#define HEAPSORT_ALL(type,compare,assign) \
+PUSH_HEAP(type,compare,assign) \
+ADJUST_HEAP(type,compare,assign) \
+MAKE_HEAP(type,assign) \
+HEAPSORT(type,assign)
+
+HEAPSORT_ALL(mpz_t,MPZ_LESS,MPZ_SHALLOW_ASSIGN)
+HEAPSORT_ALL(mpz_t_desc,MPZ_GREATER,MPZ_SHALLOW_ASSIGN)
+HEAPSORT_ALL(mpz_t_abs,MPZ_ABS_LESS,MPZ_SHALLOW_ASSIGN)
+HEAPSORT_ALL(mpz_t_bits,MPZ_BITS_LESS,MPZ_SHALLOW_ASSIGN)
+
+#endif
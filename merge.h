@@ -1,24 +1,148 @@
+#ifndef MERGE_H
+#define MERGE_H 1
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+
+#include "bigint.h"
+#include "order.h"
 
 #define LESS_THAN(a,b) ((a) < (b))
 
-#define MERGE(type,compare) \
+#define MERGE(type,compare,assign) \
 type* merge_##type(type* b1, type* e1, type* b2, type* e2, type* o) { \
   for (; b1 != e1; ++o) { \
     if (b2 == e2) { \
       while (b1 != e1) \
-        *o++ = *b1++; \
+        assign(*o++, *b1++); \
       return o; \
     } \
     type** c = compare(*b2, *b1) ? &b2 : &b1; \
-    *o = **c; ++*c; \
+    assign(*o, **c); ++*c; \
   } \
   while (b2 != e2) \
-    *o++ = *b2++; \
+    assign(*o++, *b2++); \
   return o; \
 }
 
-#define compare(a,b) LESS_THAN(a,b)
-typedef int type;
+// Runs shorter than this are extended by insertion sort
+#define mergesort_min_run 32
+
+/** @brief Natural (run-adaptive) mergesort for given type.
+ *
+ *  Splits the input into maximal ascending runs, reversing strictly
+ *  descending ones and extending short ones to mergesort_min_run by
+ *  insertion, then merges adjacent runs pairwise, ping-ponging with
+ *  a scratch buffer; needs merge_##type. Linear on presorted input.
+ *
+ *  @param b Begin pointer of input sequence.
+ *  @param e End pointer of input sequence.
+ *  @return Number of natural runs found.
+ */
+#define NATURAL_MERGESORT(type,compare,assign) \
+ptrdiff_t mergesort_##type(type* b, type* e) { \
+  const ptrdiff_t n = e - b; \
+  if (n < 2) return n; \
+  ptrdiff_t* runs = malloc((n + 1) * sizeof(ptrdiff_t)); \
+  ptrdiff_t m = 0, natural = 0; \
+  for (ptrdiff_t i = 0; i != n; ++natural) { \
+    runs[m++] = i; \
+    ptrdiff_t j = i + 1; \
+    if (j != n && compare(b[j], b[i])) { \
+      while (j + 1 != n && compare(b[j+1], b[j])) ++j; \
+      for (ptrdiff_t l = i, r = j; l < r; ++l, --r) { \
+        type t; assign(t, b[l]); assign(b[l], b[r]); assign(b[r], t); \
+      } \
+      ++j; \
+    } \
+    else \
+      while (j != n && !compare(b[j], b[j-1])) ++j; \
+    for (; j != n && j - i < mergesort_min_run; ++j) { \
+      type t; assign(t, b[j]); \
+      ptrdiff_t k = j; \
+      for (; k != i && compare(t, b[k-1]); --k) assign(b[k], b[k-1]); \
+      assign(b[k], t); \
+    } \
+    i = j; \
+  } \
+  runs[m] = n; \
+  type* buf = malloc(n * sizeof(type)); \
+  type *src = b, *dst = buf; \
+  while (m > 1) { \
+    ptrdiff_t r = 0; \
+    for (ptrdiff_t i = 0; i < m; i += 2, ++r) { \
+      ptrdiff_t lo = runs[i], mid = runs[i + 1], \
+                hi = i + 2 <= m ? runs[i + 2] : mid; \
+      merge_##type(src + lo, src + mid, src + mid, src + hi, dst + lo); \
+      runs[r] = lo; \
+    } \
+    runs[r] = n; \
+    m = r; \
+    type* t = src; src = dst; dst = t; \
+  } \
+  if (src != b) \
+    for (ptrdiff_t i = 0; i != n; ++i) assign(b[i], src[i]); \
+  free(buf); \
+  free(runs); \
+  return natural; \
+}
+
+MERGE(mpz_t,MPZ_LESS,MPZ_SHALLOW_ASSIGN)
+MERGE(mpz_t_desc,MPZ_GREATER,MPZ_SHALLOW_ASSIGN)
+MERGE(mpz_t_abs,MPZ_ABS_LESS,MPZ_SHALLOW_ASSIGN)
+MERGE(mpz_t_bits,MPZ_BITS_LESS,MPZ_SHALLOW_ASSIGN)
+NATURAL_MERGESORT(mpz_t,MPZ_LESS,MPZ_SHALLOW_ASSIGN)
+NATURAL_MERGESORT(mpz_t_desc,MPZ_GREATER,MPZ_SHALLOW_ASSIGN)
+NATURAL_MERGESORT(mpz_t_abs,MPZ_ABS_LESS,MPZ_SHALLOW_ASSIGN)
+NATURAL_MERGESORT(mpz_t_bits,MPZ_BITS_LESS,MPZ_SHALLOW_ASSIGN)
+
+/** @brief Loser tree over k input heads, for k-way merge.
+ *
+ *  Leaf i is node k+i, internal nodes are 1..k-1 and hold the index of
+ *  the input that lost the match there; loser[0] holds the overall
+ *  winner. Exhausted inputs lose to everything. After taking the
+ *  winner's head and refilling it, replay from the winner's leaf:
+ *  one compare per level, log2(k) in all.
+ */
+#define LOSER_TREE(type,compare) \
+typedef struct { \
+  int k; \
+  int* loser; \
+  type* head; \
+  bool* done; \
+} loser_tree_##type; \
+static inline bool loser_tree_less_##type(loser_tree_##type* t, int a, int b) { \
+  if (t->done[a]) return false; \
+  if (t->done[b]) return true; \
+  return compare(t->head[a], t->head[b]); \
+} \
+static int loser_tree_build_##type(loser_tree_##type* t, int n) { \
+  if (n >= t->k) return n - t->k; \
+  int l = loser_tree_build_##type(t, 2 * n); \
+  int r = loser_tree_build_##type(t, 2 * n + 1); \
+  if (loser_tree_less_##type(t, r, l)) { \
+    t->loser[n] = l; return r; \
+  } \
+  t->loser[n] = r; return l; \
+} \
+void loser_tree_init_##type(loser_tree_##type* t) { \
+  t->loser[0] = loser_tree_build_##type(t, 1); \
+} \
+void loser_tree_replay_##type(loser_tree_##type* t, int i) { \
+  int w = i; \
+  for (int n = (i + t->k) / 2; n > 0; n /= 2) { \
+    if (loser_tree_less_##type(t, t->loser[n], w)) { \
+      int l = w; w = t->loser[n]; t->loser[n] = l; \
+    } \
+  } \
+  t->loser[0] = w; \
+}
+
+LOSER_TREE(mpz_t,MPZ_LESS)
+LOSER_TREE(mpz_t_desc,MPZ_GREATER)
+LOSER_TREE(mpz_t_abs,MPZ_ABS_LESS)
+LOSER_TREE(mpz_t_bits,MPZ_BITS_LESS)
+
+#endif
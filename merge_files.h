@@ -0,0 +1,135 @@
+#ifndef MERGE_FILES_H
+#define MERGE_FILES_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+#include "merge.h"
+#include "order.h"
+#include "perf.h"
+
+// Stream buffer size per merge input
+#define merge_files_buffer_size (1 << 20)
+
+/** @brief Buffered streaming reader of one sorted input.
+ */
+typedef struct
+{
+  const char* filename;
+  FILE* file;
+  char* buf;      // token buffer
+  size_t cap;
+
+} bigint_reader;
+
+/** @brief k-way merge of sorted files for given type and compare.
+ */
+#define MERGE_FILES(type,compare) \
+static int64_t merge_files_##type(FILE* out, char** filenames, int k, \
+                                  int num_threads) \
+{ \
+  if (k < 1) \
+    return 0; \
+ \
+  bigint_reader* in = calloc(k, sizeof(bigint_reader)); \
+  loser_tree_##type t = { k, calloc(k, sizeof(int)), \
+                            calloc(k, sizeof(mpz_t)), \
+                            calloc(k, sizeof(bool)) }; \
+  mpz_t last; \
+  mpz_init(last); \
+  int res = 0; \
+  int64_t n = 0; \
+ \
+  for (int i = 0; i != k; ++i) { \
+    mpz_init(t.head[i]); \
+    in[i].filename = filenames[i]; \
+    in[i].file = fopen(filenames[i], "r"); \
+    if (!in[i].file) { \
+      fprintf(stderr, "merge: failed to open input file %s\n", filenames[i]); \
+      res = -1; \
+      t.done[i] = true; \
+      continue; \
+    } \
+    setvbuf(in[i].file, NULL, _IOFBF, merge_files_buffer_size); \
+    int r = bigint_fscan(in[i].file, t.head[i], &in[i].buf, &in[i].cap, \
+                         num_threads); \
+    t.done[i] = r != 1; \
+    if (r != 1 && r != EOF) { \
+      fprintf(stderr, "merge: %s in input file %s\n", \
+              bigint_fscan_error(r), filenames[i]); \
+      res = -1; \
+    } \
+  } \
+ \
+  perf_begin(PERF_MERGE); \
+  if (res == 0) \
+    loser_tree_init_##type(&t); \
+ \
+  while (res == 0 && !t.done[t.loser[0]]) \
+  { \
+    const int w = t.loser[0]; \
+    bigint_fprint(out, t.head[w], num_threads); \
+    fputc('\n', out); \
+    ++n; \
+ \
+    mpz_swap(last, t.head[w]); \
+    int r = bigint_fscan(in[w].file, t.head[w], &in[w].buf, &in[w].cap, \
+                         num_threads); \
+    if (r != 1 && r != EOF) { \
+      fprintf(stderr, "merge: %s in input file %s\n", \
+              bigint_fscan_error(r), in[w].filename); \
+      res = -1; \
+    } \
+    else if (r == 1 && compare(t.head[w], last)) { \
+      fprintf(stderr, "merge: input file %s is not sorted\n", in[w].filename); \
+      res = -1; \
+    } \
+    t.done[w] = r != 1; \
+    loser_tree_replay_##type(&t, w); \
+  } \
+  perf_end(PERF_MERGE); \
+ \
+  for (int i = 0; i != k; ++i) { \
+    if (in[i].file) \
+      fclose(in[i].file); \
+    free(in[i].buf); \
+    mpz_clear(t.head[i]); \
+  } \
+  mpz_clear(last); \
+  free(t.loser); \
+  free(t.head); \
+  free(t.done); \
+  free(in); \
+  return res == 0 ? n : -1; \
+}
+
+MERGE_FILES(mpz_t,MPZ_LESS)
+MERGE_FILES(mpz_t_desc,MPZ_GREATER)
+MERGE_FILES(mpz_t_abs,MPZ_ABS_LESS)
+MERGE_FILES(mpz_t_bits,MPZ_BITS_LESS)
+
+/** @brief k-way merge of sorted bigint files, written incrementally.
+ *
+ *  Each input is streamed through its own buffer with only its current
+ *  head in memory; the loser tree picks the next output in log2(k)
+ *  compares. Inputs are checked to be in order as they are read.
+ *
+ *  @param out Output stream, written decimal one per line.
+ *  @param filenames Sorted input files.
+ *  @param k Number of input files.
+ *  @param order Sort order of the inputs and output.
+ *  @param num_threads Number of threads allowed for number conversion.
+ *  @return Number of values written, -1 on open, read or order error.
+ */
+int64_t bigints_merge_files(FILE* out, char** filenames, int k,
+                        bigint_order order, int num_threads)
+{
+  return ORDER_CALL(order, merge_files_mpz_t, out, filenames, k, num_threads);
+}
+
+#endif
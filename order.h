@@ -0,0 +1,183 @@
+#ifndef ORDER_H
+#define ORDER_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+
+/** @brief Sort orders; all are total orders that agree with mpz_cmp
+ *         on equality, so each breaks its ties by signed value.
+ */
+typedef enum
+{
+  ORDER_ASC,    // signed value
+  ORDER_DESC,   // signed value, descending
+  ORDER_ABS,    // absolute value, then signed value
+  ORDER_BITS,   // bit length of absolute value, then signed value
+  order_num_orders
+
+} bigint_order;
+
+static const char* order_names[order_num_orders] =
+  { "asc", "desc", "abs", "bits" };
+
+/** @brief Parse an order name.
+ *  @return The order, or -1 if not recognised.
+ */
+int order_parse(const char* s)
+{
+  for (int o = 0; o != order_num_orders; ++o)
+    if (!strcmp(s, order_names[o]))
+      return o;
+  return -1;
+}
+
+/** @brief Compare signed limb counts and limbs, as mpz_cmp.
+ */
+static inline int limbs_cmp(mp_size_t sa, const mp_limb_t* a,
+                            mp_size_t sb, const mp_limb_t* b)
+{
+  if (sa != sb)
+    return sa < sb ? -1 : 1;
+  if (sa == 0)
+    return 0;
+  int c = mpn_cmp(a, b, sa < 0 ? -sa : sa);
+  return sa < 0 ? -c : c;
+}
+
+/** @brief Compare by absolute value, then signed value.
+ */
+static inline int limbs_cmp_abs(mp_size_t sa, const mp_limb_t* a,
+                                mp_size_t sb, const mp_limb_t* b)
+{
+  const mp_size_t na = sa < 0 ? -sa : sa, nb = sb < 0 ? -sb : sb;
+  if (na != nb)
+    return na < nb ? -1 : 1;
+  int c = na ? mpn_cmp(a, b, na) : 0;
+  return c ? c : (sa > sb) - (sa < sb);
+}
+
+/** @brief Bit length of the absolute value; 0 for zero.
+ */
+static inline size_t limbs_bits(mp_size_t s, const mp_limb_t* d)
+{
+  const size_t n = s < 0 ? -s : s;
+  return n ? n * GMP_NUMB_BITS - __builtin_clzll(d[n - 1]) : 0;
+}
+
+/** @brief Compare by bit length, then signed value.
+ */
+static inline int limbs_cmp_bits(mp_size_t sa, const mp_limb_t* a,
+                                 mp_size_t sb, const mp_limb_t* b)
+{
+  const size_t la = limbs_bits(sa, a), lb = limbs_bits(sb, b);
+  if (la != lb)
+    return la < lb ? -1 : 1;
+  return limbs_cmp(sa, a, sb, b);
+}
+
+static inline int bigint_cmp_abs(mpz_srcptr a, mpz_srcptr b)
+{
+  int c = mpz_cmpabs(a, b);
+  return c ? c : mpz_cmp(a, b);
+}
+
+static inline int bigint_cmp_bits(mpz_srcptr a, mpz_srcptr b)
+{
+  return limbs_cmp_bits(a->_mp_size, mpz_limbs_read(a),
+                        b->_mp_size, mpz_limbs_read(b));
+}
+
+/** @brief Compare in the given order, for checks and sampling; the
+ *         sorts are instantiated per order instead.
+ */
+static inline int bigint_cmp_order(bigint_order order,
+                                   mpz_srcptr a, mpz_srcptr b)
+{
+  switch (order) {
+    case ORDER_DESC: return mpz_cmp(b, a);
+    case ORDER_ABS:  return bigint_cmp_abs(a, b);
+    case ORDER_BITS: return bigint_cmp_bits(a, b);
+    default:         return mpz_cmp(a, b);
+  }
+}
+
+// Compares for the sort and merge macros, one per order
+#define MPZ_GREATER(a,b) (mpz_cmp(a,b) > 0)
+#define MPZ_ABS_LESS(a,b) (bigint_cmp_abs(a,b) < 0)
+#define MPZ_BITS_LESS(a,b) (bigint_cmp_bits(a,b) < 0)
+
+/** @brief Order-preserving key prefixes, as limbs_prefix, per order.
+ *
+ *  desc: complement of the ascending prefix.
+ *  abs: ascending prefix of the absolute value.
+ *  bits: 22-bit bit length, sign bit (set for >= 0), then the 41 bits
+ *        after the leading one, inverted for negative values.
+ */
+static inline uint64_t limbs_prefix_desc(mp_size_t size, const mp_limb_t* d)
+{
+  return ~limbs_prefix(size, d);
+}
+
+static inline uint64_t limbs_prefix_abs(mp_size_t size, const mp_limb_t* d)
+{
+  return limbs_prefix(size < 0 ? -size : size, d);
+}
+
+static inline uint64_t limbs_prefix_bits(mp_size_t size, const mp_limb_t* d)
+{
+  const uint64_t k = limbs_prefix(size, d);
+  const uint64_t nonneg = k >> 63;
+  const uint64_t bits = (nonneg ? k >> 41 : ~k >> 41) & 0x3fffff;
+  return bits << 42 | nonneg << 41 | (k & ((UINT64_C(1) << 41) - 1));
+}
+
+static inline uint64_t bigint_prefix_desc(const bigint b)
+{
+  return limbs_prefix_desc(b->_mp_size, mpz_limbs_read(b));
+}
+
+static inline uint64_t bigint_prefix_abs(const bigint b)
+{
+  return limbs_prefix_abs(b->_mp_size, mpz_limbs_read(b));
+}
+
+static inline uint64_t bigint_prefix_bits(const bigint b)
+{
+  return limbs_prefix_bits(b->_mp_size, mpz_limbs_read(b));
+}
+
+/** @brief Exact keys for values that fit a signed 64-bit word.
+ */
+static inline uint64_t bigint_fixed_key(const bigint b)
+{
+  return (uint64_t)mpz_get_si(b) ^ UINT64_C(1) << 63;
+}
+
+static inline uint64_t bigint_fixed_key_desc(const bigint b)
+{
+  return ~bigint_fixed_key(b);
+}
+
+// Element type names for the per-order sort instantiations, so that
+// quicksort_mpz_t_desc etc. sort plain mpz_t arrays
+typedef mpz_t mpz_t_desc;
+typedef mpz_t mpz_t_abs;
+typedef mpz_t mpz_t_bits;
+
+/** @brief Call the instantiation of fn for the order: fn for ascending,
+ *         else fn_desc, fn_abs or fn_bits. One branch per call, not
+ *         per compare.
+ */
+#define ORDER_CALL(order,fn,...) \
+  ((order) == ORDER_DESC ? fn##_desc(__VA_ARGS__) \
+ : (order) == ORDER_ABS  ? fn##_abs(__VA_ARGS__) \
+ : (order) == ORDER_BITS ? fn##_bits(__VA_ARGS__) \
+ : fn(__VA_ARGS__))
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef PARALLEL_SORT_H
+#define PARALLEL_SORT_H 1
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+#include "merge.h"
+#include "order.h"
+#include "perf.h"
+#include "spawn.h"
+#include "topology.h"
+
+// Fewest elements per thread worth sorting in parallel
+#define parallel_min_chunk 4096
+
+/** @brief Sequential sort run by each thread on its chunk.
+ */
+typedef void (*chunk_sort_fn)(bigint_array b, bigint_order order, void* ctx);
+
+/** @brief k-way merge of sorted runs into out, shallow struct copies.
+ */
+#define MERGE_RUNS(type) \
+static void merge_runs_##type(const bigint_array* runs, int k, mpz_t* out) { \
+  loser_tree_##type t = { k, malloc(k * sizeof(int)), \
+                          malloc(k * sizeof(mpz_t)), \
+                          malloc(k * sizeof(bool)) }; \
+  ptrdiff_t* pos = calloc(k, sizeof(ptrdiff_t)); \
+  for (int i = 0; i != k; ++i) \
+    if (!(t.done[i] = runs[i].size == 0)) \
+      MPZ_SHALLOW_ASSIGN(t.head[i], runs[i].data[0]); \
+  loser_tree_init_##type(&t); \
+  while (!t.done[t.loser[0]]) { \
+    const int w = t.loser[0]; \
+    MPZ_SHALLOW_ASSIGN(*out, t.head[w]); \
+    ++out; \
+    if (++pos[w] == runs[w].size) \
+      t.done[w] = true; \
+    else \
+      MPZ_SHALLOW_ASSIGN(t.head[w], runs[w].data[pos[w]]); \
+    loser_tree_replay_##type(&t, w); \
+  } \
+  free(pos); \
+  free(t.loser); \
+  free(t.head); \
+  free(t.done); \
+}
+
+MERGE_RUNS(mpz_t)
+MERGE_RUNS(mpz_t_desc)
+MERGE_RUNS(mpz_t_abs)
+MERGE_RUNS(mpz_t_bits)
+
+typedef struct
+{
+  bigint_array in;      // slice of the input
+  bigint_array run;     // sorted run: the slice, or its local copy
+  int cpu;              // pinned CPU, or -1
+  bool first_touch;     // copy the slice and its limbs on this thread
+  pthread_t caller;     // run inline on this thread if none was started
+  bigint_order order;
+  chunk_sort_fn sort;
+  void* ctx;
+
+} parallel_chunk;
+
+/** @brief Pin, take a local copy of the slice if first_touch, and sort.
+ *
+ *  The copy's structs and limbs are allocated and written by this
+ *  thread, so under the kernel's first-touch policy their pages are on
+ *  this thread's node; the slice's own limbs are released.
+ */
+static void* parallel_chunk_task(void* arg)
+{
+  parallel_chunk* c = arg;
+  const bool spawned = !pthread_equal(pthread_self(), c->caller);
+  perf_muted = spawned;
+  topology_pin(spawned ? c->cpu : -1);
+  c->run = c->in;
+  if (c->first_touch) {
+    c->run.data = malloc((c->in.size + 1) * sizeof(mpz_t));
+    for (uint32_t i = 0; i != c->in.size; ++i) {
+      mpz_init_set(c->run.data[i], c->in.data[i]);
+      mpz_clear(c->in.data[i]);
+    }
+  }
+  c->sort(c->run, c->order, c->ctx);
+  return NULL;
+}
+
+typedef struct
+{
+  const bigint_array* runs;
+  int k;
+  bigint_array out;     // node-local merge of the runs
+  int cpu;
+  pthread_t caller;
+  bigint_order order;
+
+} parallel_node;
+
+/** @brief Merge one node's runs into a buffer first touched on the node.
+ */
+static void* parallel_node_task(void* arg)
+{
+  parallel_node* m = arg;
+  if (m->k == 0)
+    return NULL;   // no threads placed on this node
+  const bool spawned = !pthread_equal(pthread_self(), m->caller);
+  perf_muted = spawned;
+  topology_pin(spawned ? m->cpu : -1);
+  for (int i = 0; i != m->k; ++i)
+    m->out.size += m->runs[i].size;
+  m->out.data = malloc((m->out.size + 1) * sizeof(mpz_t));
+  ORDER_CALL(m->order, merge_runs_mpz_t, m->runs, m->k, m->out.data);
+  return NULL;
+}
+
+/** @brief Sort in parallel: sorted chunks, node-local merges, then one
+ *         cross-node merge.
+ *
+ *  The array is split into one chunk per thread, each sorted by the
+ *  sequential sort on its own thread. With an affinity mode, threads
+ *  are pinned by mode and first-touch a copy of their chunk and its
+ *  limbs; chunks are grouped by node, each group merged on its node
+ *  into node-local memory, and the node runs are finally merged back
+ *  into b. Without one, all chunks are merged directly back into b.
+ *
+ *  @param b Big integer 'array' (data ptr & size struct).
+ *  @param order Sort order.
+ *  @param num_threads Number of sorting threads.
+ *  @param affinity Thread placement, or AFFINITY_NONE.
+ *  @param sort Sequential sort for each chunk.
+ *  @param ctx Context for sort.
+ *  @param num_nodes If not NULL, set to the number of nodes used.
+ */
+void bigints_sort_parallel(bigint_array b, bigint_order order, int num_threads,
+                           affinity_mode affinity, chunk_sort_fn sort,
+                           void* ctx, int* num_nodes)
+{
+  const ptrdiff_t n = b.size;
+  if (num_threads > n / parallel_min_chunk)
+    num_threads = n / parallel_min_chunk;
+  if (num_threads < 1)
+    num_threads = 1;
+
+  const bool local = affinity != AFFINITY_NONE;
+  topology topo = topology_read();
+  const int t_nodes = local ? topo.num_nodes : 1;
+
+  // chunks grouped by node, so that each node's runs are contiguous
+  parallel_chunk* chunks = malloc(num_threads * sizeof(parallel_chunk));
+  int* node_first = calloc(t_nodes + 1, sizeof(int));
+  for (int t = 0; t != num_threads; ++t)
+    ++node_first[local ? topology_thread_node(&topo, affinity, t) + 1 : 1];
+  for (int k = 0; k != t_nodes; ++k)
+    node_first[k + 1] += node_first[k];
+  int* fill = malloc(t_nodes * sizeof(int));
+  memcpy(fill, node_first, t_nodes * sizeof(int));
+  for (int t = 0; t != num_threads; ++t) {
+    const int k = local ? topology_thread_node(&topo, affinity, t) : 0;
+    const ptrdiff_t i = fill[k]++;
+    const ptrdiff_t lo = n * i / num_threads, hi = n * (i + 1) / num_threads;
+    chunks[i] = (parallel_chunk){ { hi - lo, b.data + lo }, {},
+                                  topology_thread_cpu(&topo, affinity, t),
+                                  local, pthread_self(), order, sort, ctx };
+  }
+  free(fill);
+
+  // every chunk on its own thread, so the caller is never pinned
+  spawn_all(parallel_chunk_task, chunks, sizeof(parallel_chunk),
+            num_threads, false);
+
+  bigint_array* runs = malloc(num_threads * sizeof(bigint_array));
+  for (int t = 0; t != num_threads; ++t)
+    runs[t] = chunks[t].run;
+
+  perf_begin(PERF_MERGE);
+  int used = 0;
+  for (int k = 0; k != t_nodes; ++k)
+    used += node_first[k + 1] != node_first[k];
+  if (used <= 1)
+  {
+    // runs alias b unless copied
+    mpz_t* out = local ? b.data : malloc((n + 1) * sizeof(mpz_t));
+    ORDER_CALL(order, merge_runs_mpz_t, runs, num_threads, out);
+    if (out != b.data) {
+      memcpy(b.data, out, n * sizeof(mpz_t));
+      free(out);
+    }
+  }
+  else
+  {
+    parallel_node* nodes = malloc(t_nodes * sizeof(parallel_node));
+    bigint_array* node_runs = malloc(t_nodes * sizeof(bigint_array));
+    for (int k = 0; k != t_nodes; ++k) {
+      const int i = node_first[k];
+      nodes[k] = (parallel_node){ runs + i, node_first[k + 1] - i, {},
+                                  i != num_threads ? chunks[i].cpu : -1,
+                                  pthread_self(), order };
+    }
+    spawn_all(parallel_node_task, nodes, sizeof(parallel_node),
+              t_nodes, false);
+    for (int k = 0; k != t_nodes; ++k)
+      node_runs[k] = nodes[k].out;
+    ORDER_CALL(order, merge_runs_mpz_t, node_runs, t_nodes, b.data);
+    for (int k = 0; k != t_nodes; ++k)
+      free(nodes[k].out.data);
+    free(node_runs);
+    free(nodes);
+  }
+  perf_end(PERF_MERGE);
+
+  // merged structs now own the limbs; free only the copies' arrays
+  if (local)
+    for (int t = 0; t != num_threads; ++t)
+      free(chunks[t].run.data);
+  free(runs);
+  free(chunks);
+  free(node_first);
+  if (num_nodes)
+    *num_nodes = used;
+  topology_clear(&topo);
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef PERF_H
+#define PERF_H 1
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** @brief Program phases measured by --perf.
+ *
+ *  Phases may nest (partition inside sort); each is timed from its
+ *  outermost begin to the matching end.
+ */
+typedef enum
+{
+  PERF_PARSE,
+  PERF_KEYS,        // key prefix extraction
+  PERF_PARTITION,   // quicksort, partition passes
+  PERF_MERGE,       // mergesort passes and k-way merges
+  PERF_SORT,        // whole sort, labelled with the algorithm
+  PERF_WRITE,
+  perf_num_phases
+
+} perf_phase;
+
+#define perf_num_counters 4
+
+static const char* perf_phase_names[perf_num_phases] =
+  { "parse", "keys", "partition", "merge", "sort", "write" };
+
+static const char* perf_counter_names[perf_num_counters] =
+  { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+static const uint64_t perf_counter_configs[perf_num_counters] =
+  { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+/** @brief Hardware counter state; one per process.
+ */
+typedef struct
+{
+  bool enabled;
+  int fd[perf_num_counters];     // -1 where the counter is unavailable
+  char error[64];                // why counters are unavailable
+  const char* algorithm;         // label for PERF_SORT
+  int depth[perf_num_phases];
+  bool used[perf_num_phases];
+  uint64_t start[perf_num_phases][perf_num_counters];
+  uint64_t total[perf_num_phases][perf_num_counters];
+
+} perf_state;
+
+static perf_state perf = { .fd = { -1, -1, -1, -1 } };
+
+// Set in worker threads, whose counts the inherited counters already
+// include in the phases the main thread measures
+static __thread bool perf_muted;
+
+/** @brief Open the counters for this process and threads it starts.
+ *
+ *  Counters are opened one by one, inheriting into new threads, so any
+ *  that the CPU, VM or perf_event_paranoid setting refuses are just
+ *  reported as unavailable.
+ *
+ *  @return true if at least one counter is available.
+ */
+bool perf_open()
+{
+  perf.enabled = true;
+  bool any = false;
+  for (int c = 0; c != perf_num_counters; ++c)
+  {
+    struct perf_event_attr attr = {
+      .type = PERF_TYPE_HARDWARE,
+      .size = sizeof attr,
+      .config = perf_counter_configs[c],
+      .inherit = 1,
+      .exclude_kernel = 1,
+      .exclude_hv = 1
+    };
+    perf.fd[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf.fd[c] >= 0)
+      any = true;
+    else if (!*perf.error)
+      snprintf(perf.error, sizeof perf.error, "%s: %s",
+               perf_counter_names[c], strerror(errno));
+  }
+  return any;
+}
+
+void perf_close()
+{
+  for (int c = 0; c != perf_num_counters; ++c)
+    if (perf.fd[c] >= 0) {
+      close(perf.fd[c]);
+      perf.fd[c] = -1;
+    }
+}
+
+static inline void perf_read(uint64_t v[perf_num_counters])
+{
+  for (int c = 0; c != perf_num_counters; ++c)
+    if (perf.fd[c] < 0 || read(perf.fd[c], &v[c], sizeof v[c]) != sizeof v[c])
+      v[c] = 0;
+}
+
+/** @brief Start measuring a phase; no-op unless --perf.
+ */
+static inline void perf_begin(perf_phase p)
+{
+  if (perf.enabled && !perf_muted && perf.depth[p]++ == 0)
+    perf_read(perf.start[p]);
+}
+
+/** @brief Stop measuring a phase, adding to its totals.
+ */
+static inline void perf_end(perf_phase p)
+{
+  if (!perf.enabled || perf_muted || --perf.depth[p] != 0)
+    return;
+  uint64_t v[perf_num_counters];
+  perf_read(v);
+  for (int c = 0; c != perf_num_counters; ++c)
+    perf.total[p][c] += v[c] - perf.start[p][c];
+  perf.used[p] = true;
+}
+
+/** @brief Write counters as a JSON object member, "perf": {...}.
+ */
+void perf_print_json(FILE* fs)
+{
+  fprintf(fs, "  \"perf\": {\n    \"counters\": {");
+  for (int c = 0; c != perf_num_counters; ++c)
+    fprintf(fs, "%s \"%s\": %s", c ? "," : "", perf_counter_names[c],
+            perf.fd[c] >= 0 ? "true" : "false");
+  fprintf(fs, " },\n    \"error\": \"%s\",\n    \"algorithm\": \"%s\"",
+          perf.error, perf.algorithm ? perf.algorithm : "");
+
+  for (int p = 0; p != perf_num_phases; ++p) {
+    if (!perf.used[p])
+      continue;
+    fprintf(fs, ",\n    \"%s\": {", perf_phase_names[p]);
+    bool first = true;
+    for (int c = 0; c != perf_num_counters; ++c)
+      if (perf.fd[c] >= 0) {
+        fprintf(fs, "%s \"%s\": %" PRIu64, first ? "" : ",",
+                perf_counter_names[c], perf.total[p][c]);
+        first = false;
+      }
+    fprintf(fs, " }");
+  }
+  fprintf(fs, "\n  },\n");
+}
+
+/** @brief One line summary of a phase, for the text UI panel.
+ */
+void perf_summary(char* buf, size_t n, perf_phase p)
+{
+  const uint64_t* t = perf.total[p];
+  if (!perf.enabled)
+    snprintf(buf, n, "off (--perf)");
+  else if (perf.fd[0] < 0 && perf.fd[1] < 0 && perf.fd[2] < 0 && perf.fd[3] < 0)
+    snprintf(buf, n, "unavailable, %s", perf.error);
+  else if (!perf.used[p])
+    snprintf(buf, n, "%s: not run", perf_phase_names[p]);
+  else
+    snprintf(buf, n, "%s: %.3gG cyc %.2f IPC %.3gM cache-miss %.3gM br-miss",
+             perf_phase_names[p], t[0] * 1e-9,
+             t[0] ? (double)t[1] / t[0] : 0.0, t[2] * 1e-6, t[3] * 1e-6);
+}
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef QUERY_H
+#define QUERY_H 1
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+#include "perf.h"
+#include "radix.h"
+#include "spawn.h"
+
+/** @brief Search index over a sorted bigint array.
+ *
+ *  Holds the 64-bit key prefixes of the array both in sorted order,
+ *  for merge-style sweeps, and in Eytzinger (BFS) order, for branch
+ *  free cache friendly binary search; prefixes narrow a search to an
+ *  equal-prefix range that mpz_cmp then finishes.
+ */
+typedef struct
+{
+  ptrdiff_t n;
+  const mpz_t* data;
+  uint64_t* prefix;     // prefix[i] = bigint_prefix(data[i])
+  uint64_t* eyt;        // 1-based Eytzinger layout of prefix
+  uint32_t* eyt_rank;   // sorted index of each Eytzinger slot
+
+} bigint_index;
+
+static ptrdiff_t index_build_eyt(bigint_index* ix, ptrdiff_t i, ptrdiff_t k)
+{
+  if (k <= ix->n) {
+    i = index_build_eyt(ix, i, 2 * k);
+    ix->eyt[k] = ix->prefix[i];
+    ix->eyt_rank[k] = i++;
+    i = index_build_eyt(ix, i, 2 * k + 1);
+  }
+  return i;
+}
+
+/** @brief Build search index over a sorted bigint array.
+ */
+bigint_index bigint_index_build(bigint_array b)
+{
+  bigint_index ix = { b.size, (const mpz_t*)b.data,
+                      malloc((b.size + 1) * sizeof(uint64_t)),
+                      malloc((b.size + 1) * sizeof(uint64_t)),
+                      malloc((b.size + 1) * sizeof(uint32_t)) };
+  perf_begin(PERF_KEYS);
+  for (ptrdiff_t i = 0; i != ix.n; ++i)
+    ix.prefix[i] = bigint_prefix(b.data[i]);
+  index_build_eyt(&ix, 0, 1);
+  perf_end(PERF_KEYS);
+  return ix;
+}
+
+void bigint_index_clear(bigint_index* ix)
+{
+  free(ix->prefix);
+  free(ix->eyt);
+  free(ix->eyt_rank);
+  ix->n = 0;
+}
+
+/** @brief First sorted index whose prefix is >= p, by Eytzinger search.
+ */
+ptrdiff_t index_lower_prefix(const bigint_index* ix, uint64_t p)
+{
+  size_t k = 1;
+  while (k <= (size_t)ix->n) {
+    __builtin_prefetch(ix->eyt + 16 * k);
+    k = 2 * k + (ix->eyt[k] < p);
+  }
+  k >>= __builtin_ffsll(~k);
+  return k ? ix->eyt_rank[k] : ix->n;
+}
+
+/** @brief First index in [i, n) whose prefix is >= p, galloping from i.
+ */
+ptrdiff_t index_gallop_prefix(const bigint_index* ix, ptrdiff_t i, uint64_t p)
+{
+  ptrdiff_t step = 1, hi = i;
+  while (hi < ix->n && ix->prefix[hi] < p) {
+    i = hi + 1;
+    hi += step;
+    step *= 2;
+  }
+  if (hi > ix->n)
+    hi = ix->n;
+  while (i < hi) {
+    ptrdiff_t m = i + (hi - i) / 2;
+    if (ix->prefix[m] < p)
+      i = m + 1;
+    else
+      hi = m;
+  }
+  return i;
+}
+
+/** @brief Finish a search within the equal-prefix range [lo, hi).
+ *  @return First index with data > x if upper, else with data >= x.
+ */
+ptrdiff_t index_refine(const bigint_index* ix, ptrdiff_t lo, ptrdiff_t hi,
+                       mpz_srcptr x, bool upper)
+{
+  while (lo < hi) {
+    ptrdiff_t m = lo + (hi - lo) / 2;
+    int c = mpz_cmp(ix->data[m], x);
+    if (c < 0 || (upper && c == 0))
+      lo = m + 1;
+    else
+      hi = m;
+  }
+  return lo;
+}
+
+typedef enum { QUERY_MEMBER, QUERY_RANK, QUERY_COUNT, QUERY_KTH } query_op;
+
+/** @brief One query; count has the closed range [x, y].
+ */
+typedef struct
+{
+  query_op op;
+  mpz_t x, y;
+  uint64_t k;
+  ptrdiff_t bound[2];   // lower_bound(x), upper_bound(y)
+
+} bigint_query;
+
+typedef struct
+{
+  const bigint_index* ix;
+  bigint_query* q;
+  const uint64_t* keys;    // probe prefixes, sorted
+  const uint32_t* probe;   // probe = 2 * query + (upper bound of y)
+  ptrdiff_t b, e;
+  bool sweep;
+
+} query_chunk;
+
+/** @brief Resolve a sorted slice of probes, by sweep or index search.
+ */
+static void* query_chunk_task(void* arg)
+{
+  query_chunk* c = arg;
+  const bigint_index* ix = c->ix;
+  ptrdiff_t cur = 0;
+  for (ptrdiff_t i = c->b; i != c->e; ++i)
+  {
+    const uint64_t p = c->keys[i];
+    bigint_query* q = &c->q[c->probe[i] / 2];
+    const bool upper = c->probe[i] & 1;
+
+    ptrdiff_t lo = c->sweep ? (cur = index_gallop_prefix(ix, cur, p))
+                            : index_lower_prefix(ix, p);
+    ptrdiff_t hi = p == UINT64_MAX ? ix->n
+                 : c->sweep ? index_gallop_prefix(ix, lo, p + 1)
+                 : index_lower_prefix(ix, p + 1);
+    q->bound[upper] = index_refine(ix, lo, hi, upper ? q->y : q->x, upper);
+  }
+  return NULL;
+}
+
+/** @brief Answer a batch of queries against a sorted array.
+ *
+ *  The batch's search keys are radix sorted by prefix and split into
+ *  contiguous slices, one per thread. Large batches relative to the
+ *  array are resolved by a galloping merge-style sweep; small ones by
+ *  Eytzinger searches, which the sorted order keeps cache-warm.
+ *
+ *  @param ix Index of the sorted array.
+ *  @param q Queries; bounds are filled in.
+ *  @param m Number of queries.
+ *  @param num_threads Number of threads allowed to work on this.
+ */
+void bigints_query(const bigint_index* ix, bigint_query* q, ptrdiff_t m,
+                   int num_threads)
+{
+  uint64_t* keys = malloc((2 * m + 1) * sizeof(uint64_t));
+  uint32_t* probe = malloc((2 * m + 1) * sizeof(uint32_t));
+  ptrdiff_t np = 0;
+  for (ptrdiff_t i = 0; i != m; ++i)
+    if (q[i].op != QUERY_KTH) {
+      keys[np] = bigint_prefix(q[i].x);
+      probe[np++] = 2 * i;
+      if (q[i].op == QUERY_COUNT) {
+        keys[np] = bigint_prefix(q[i].y);
+        probe[np++] = 2 * i + 1;
+      }
+    }
+  if (np > 1)
+    radix_sort_keys(keys, probe, np);
+
+  // sweep when probes are dense enough that galloping beats searching
+  int log_n = 1;
+  while (((ptrdiff_t)1 << log_n) < ix->n)
+    ++log_n;
+  const bool sweep = np * log_n >= ix->n;
+
+  if (num_threads > np)
+    num_threads = np ? np : 1;
+  query_chunk chunks[num_threads];
+  for (int t = 0; t != num_threads; ++t)
+    chunks[t] = (query_chunk){ ix, q, keys, probe, np * t / num_threads,
+                               np * (t + 1) / num_threads, sweep };
+  spawn_all(query_chunk_task, chunks, sizeof(query_chunk),
+            num_threads, true);
+
+  free(keys);
+  free(probe);
+}
+
+/** @brief Read queries, one per line:
+ *
+ *    member X     1 if X is present, else 0
+ *    rank X       number of elements less than X
+ *    count LO HI  number of elements in [LO, HI]
+ *    kth K        element of rank K (from 0), or - if out of range
+ *
+ *  @param f Query stream.
+ *  @param m Set to number of queries read, or -1 on error.
+ *  @param num_threads Number of threads allowed for number conversion.
+ *  @return Queries, to be released with bigint_queries_clear; NULL if
+ *          none, or on a malformed line, reported on stderr.
+ */
+bigint_query* bigint_queries_read(FILE* f, ptrdiff_t* m, int num_threads)
+{
+  bigint_query* q = NULL;
+  ptrdiff_t cap = 0;
+  char* line = NULL;
+  size_t len = 0;
+  *m = 0;
+
+  for (ptrdiff_t lineno = 1; getline(&line, &len, f) != -1; ++lineno)
+  {
+    char* save;
+    char* op = strtok_r(line, " \t\r\n", &save);
+    if (!op)
+      continue;
+    if (*m == cap) {
+      cap = cap ? 2 * cap : 1024;
+      q = realloc(q, cap * sizeof(bigint_query));
+    }
+    bigint_query* n = &q[*m];
+    mpz_init(n->x);
+    mpz_init(n->y);
+    n->k = 0;
+    ++*m;
+
+    char* a = strtok_r(NULL, " \t\r\n", &save);
+    char* b = strtok_r(NULL, " \t\r\n", &save);
+    bool ok = a != NULL;
+    if (!strcmp(op, "member") || !strcmp(op, "rank")) {
+      n->op = *op == 'm' ? QUERY_MEMBER : QUERY_RANK;
+      ok = ok && !b && bigint_set_str(n->x, a, 10, num_threads) == 0;
+    }
+    else if (!strcmp(op, "count")) {
+      n->op = QUERY_COUNT;
+      ok = ok && b && bigint_set_str(n->x, a, 10, num_threads) == 0
+              && bigint_set_str(n->y, b, 10, num_threads) == 0;
+    }
+    else if (!strcmp(op, "kth")) {
+      n->op = QUERY_KTH;
+      char* end;
+      ok = ok && !b && (n->k = strtoull(a, &end, 10), *end == '\0');
+    }
+    else
+      ok = false;
+
+    if (!ok) {
+      fprintf(stderr, "query: bad query on line %td\n", lineno);
+      free(line);
+      for (ptrdiff_t i = 0; i != *m; ++i) {
+        mpz_clear(q[i].x);
+        mpz_clear(q[i].y);
+      }
+      free(q);
+      *m = -1;
+      return NULL;
+    }
+  }
+  free(line);
+  return q;
+}
+
+void bigint_queries_clear(bigint_query* q, ptrdiff_t m)
+{
+  for (ptrdiff_t i = 0; i != m; ++i) {
+    mpz_clear(q[i].x);
+    mpz_clear(q[i].y);
+  }
+  free(q);
+}
+
+/** @brief Write answers to resolved queries, one per line, in order.
+ */
+void bigint_queries_write(FILE* fs, const bigint_index* ix,
+                          const bigint_query* q, ptrdiff_t m, int num_threads)
+{
+  for (ptrdiff_t i = 0; i != m; ++i)
+  {
+    const ptrdiff_t lo = q[i].bound[0];
+    switch (q[i].op) {
+      case QUERY_MEMBER:
+        fprintf(fs, "%d\n", lo != ix->n && mpz_cmp(ix->data[lo], q[i].x) == 0);
+        break;
+      case QUERY_RANK:
+        fprintf(fs, "%td\n", lo);
+        break;
+      case QUERY_COUNT:
+        fprintf(fs, "%td\n", q[i].bound[1] > lo ? q[i].bound[1] - lo : 0);
+        break;
+      case QUERY_KTH:
+        if (q[i].k < (uint64_t)ix->n)
+          bigint_fprint(fs, ix->data[q[i].k], num_threads);
+        else
+          fputc('-', fs);
+        fputc('\n', fs);
+        break;
+    }
+  }
+}
+
+#endif
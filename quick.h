@@ -8,25 +8,33 @@
 #include <stdbool.h>
 #include <stdio.h>
 
-#define MPZ_SHALLOW_ASSIGN(a,b) *a=*b
+#include "bigint.h"
+#include "heap.h"
+#include "order.h"
+
+// Partitions of at least this many elements take a ninther pivot
+#define quicksort_ninther 128
 
 mpz_t* partition_mpz_t(mpz_t* b, mpz_t* e, mpz_t v, bool neg);
 void quicksort_mpz_t(mpz_t* b, mpz_t* e);
 
+/** @brief Partition predicate: x < v, or x <= v if neg.
+ */
+#define PARTITION_PRED(compare,x,v,neg) ((neg) ? !compare(v,x) : compare(x,v))
+
 /** @brief Partition for given type with baked-in compare.
  *  @param b Begin pointer of input sequence.
  *  @param e End pointer of input sequence.
  *  @param v Value of pivot element.
- *  @param neg Negate the comparison if true.
+ *  @param neg Move elements <= v to front if true, else elements < v.
  */
 #define PARTITION(type,compare,swap) \
 type* partition_##type(type* b, type* e, type v, bool neg) { \
   for (; b != e; ++b) \
-    if (compare(*b,v) == neg) break; \
-  printf("%d %d %d,",*b,v,neg); \
+    if (!PARTITION_PRED(compare,*b,v,neg)) break; \
   if (b == e) return b; \
-  for (type* i = ++b; i != e; ++i) { \
-    if (compare(*i,v) != neg) { \
+  for (type* i = b+1; i != e; ++i) { \
+    if (PARTITION_PRED(compare,*i,v,neg)) { \
       swap(*i,*b); \
       ++b; \
     } \
@@ -40,11 +48,10 @@ type* partition_##type(type* b, type* e, type v, bool neg) { \
 
 int* partition_int(int* b, int* e, int v, bool neg) {
   for (; b != e; ++b)
-    if ((*b < v) == neg) break;
-  //printf("%d %d %d,",*b,v,neg);
+    if (!PARTITION_PRED(COMPARE,*b,v,neg)) break;
   if (b == e) return b;
   for (int* i = b+1; i != e; ++i) {
-    if ((*i < v) != neg) {
+    if (PARTITION_PRED(COMPARE,*i,v,neg)) {
       ITER_SWAP(i,b);
       ++b;
     }
@@ -52,27 +59,74 @@ int* partition_int(int* b, int* e, int v, bool neg) {
   return b;
 }
 
-//PARTITION(int,COMPARE,SWAP)
-//PARTITION(mpz_t,mpz_cmp,mpz_swap)
+PARTITION(mpz_t,MPZ_LESS,mpz_swap)
+PARTITION(mpz_t_desc,MPZ_GREATER,mpz_swap)
+PARTITION(mpz_t_abs,MPZ_ABS_LESS,mpz_swap)
+PARTITION(mpz_t_bits,MPZ_BITS_LESS,mpz_swap)
+
+/** @brief Pointer to the median of *a, *b and *c.
+ */
+#define MEDIAN3(type,compare) \
+static type* median3_##type(type* a, type* b, type* c) { \
+  if (compare(*a,*b)) \
+    return compare(*b,*c) ? b : compare(*a,*c) ? c : a; \
+  return compare(*a,*c) ? a : compare(*b,*c) ? c : b; \
+}
 
-/** @brief Unbalanced quicksort for given type.
+/** @brief Three-way introsort for given type; needs heapsort_##type.
+ *
+ *  Median-of-3 pivots, ninthers on large partitions; recurses into the
+ *  smaller side and loops on the larger, so stack depth is O(log n),
+ *  and falls back to heapsort past 2 log2 n levels, so time is
+ *  O(n log n) on any input.
+ *
  *  @param b Begin pointer of input sequence.
  *  @param e End pointer of input sequence.
  */
-#define QUICKSORT(type,assign) \
+#define QUICKSORT(type,compare,assign) \
+MEDIAN3(type,compare) \
+static void introsort_##type(type* b, type* e, int depth) { \
+  while (e - b > 1) { \
+    const ptrdiff_t n = e - b; \
+    if (depth-- == 0) { \
+      heapsort_##type(b, e); \
+      return; \
+    } \
+    type* m = b + n / 2; \
+    if (n >= quicksort_ninther) { \
+      const ptrdiff_t s = n / 8; \
+      m = median3_##type(median3_##type(b, b + s, b + 2 * s), \
+                         median3_##type(m - s, m, m + s), \
+                         median3_##type(e - 1 - 2 * s, e - 1 - s, e - 1)); \
+    } \
+    else \
+      m = median3_##type(b, m, e - 1); \
+    type pivot; assign(pivot,*m); \
+    type* mid1 = partition_##type(b,e,pivot,false); \
+    type* mid2 = partition_##type(mid1,e,pivot,true); \
+    if (mid1 - b < e - mid2) { \
+      introsort_##type(b, mid1, depth); \
+      b = mid2; \
+    } \
+    else { \
+      introsort_##type(mid2, e, depth); \
+      e = mid1; \
+    } \
+  } \
+} \
 void quicksort_##type(type* b, type* e) { \
-  ptrdiff_t n = e - b; \
-  if (n < 2) \
-    return; \
-  type pivot; assign(pivot,*(b + n / 2)); \
-  type* mid1 = partition_##type(b,e,pivot,false); \
-  type* mid2 = partition_##type(mid1,e,pivot,true); \
-  quicksort_##type(b, mid1); \
-  quicksort_##type(mid2, e); \
+  int depth = 0; \
+  for (ptrdiff_t n = e - b; n > 1; n >>= 1) \
+    depth += 2; \
+  introsort_##type(b, e, depth); \
 }
 
-QUICKSORT(int,ASSIGN)
-//QUICKSORT(mpz_t,MPZ_SHALLOW_ASSIGN)
+HEAPSORT_ALL(int,COMPARE,ASSIGN)
+
+QUICKSORT(int,COMPARE,ASSIGN)
+QUICKSORT(mpz_t,MPZ_LESS,MPZ_SHALLOW_ASSIGN)
+QUICKSORT(mpz_t_desc,MPZ_GREATER,MPZ_SHALLOW_ASSIGN)
+QUICKSORT(mpz_t_abs,MPZ_ABS_LESS,MPZ_SHALLOW_ASSIGN)
+QUICKSORT(mpz_t_bits,MPZ_BITS_LESS,MPZ_SHALLOW_ASSIGN)
 
-//printf("%td",n);
 #endif
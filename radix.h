@@ -0,0 +1,127 @@
+#ifndef RADIX_H
+#define RADIX_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+#include "order.h"
+#include "perf.h"
+#include "quick.h"
+
+/** @brief LSD radix sort of 64-bit keys carrying 32-bit indices.
+ *
+ *  One histogram pass counts all eight bytes; byte passes in which
+ *  every key falls in one bucket are skipped.
+ *
+ *  @param keys Keys, sorted in place.
+ *  @param idx Indices, permuted along with keys.
+ *  @param n Number of keys.
+ */
+void radix_sort_keys(uint64_t* keys, uint32_t* idx, ptrdiff_t n)
+{
+  size_t (*count)[256] = calloc(8, sizeof *count);
+  for (ptrdiff_t i = 0; i != n; ++i)
+    for (int d = 0; d != 8; ++d)
+      ++count[d][keys[i] >> 8 * d & 0xff];
+
+  uint64_t* k2 = malloc(n * sizeof(uint64_t));
+  uint32_t* i2 = malloc(n * sizeof(uint32_t));
+
+  for (int d = 0; d != 8; ++d)
+  {
+    if (count[d][keys[0] >> 8 * d & 0xff] == (size_t)n)
+      continue;
+    size_t pos = 0;
+    for (int c = 0; c != 256; ++c) {
+      size_t t = count[d][c];
+      count[d][c] = pos;
+      pos += t;
+    }
+    for (ptrdiff_t i = 0; i != n; ++i) {
+      size_t o = count[d][keys[i] >> 8 * d & 0xff]++;
+      k2[o] = keys[i];
+      i2[o] = idx[i];
+    }
+    memcpy(keys, k2, n * sizeof(uint64_t));
+    memcpy(idx, i2, n * sizeof(uint32_t));
+  }
+  free(k2);
+  free(i2);
+  free(count);
+}
+
+/** @brief Check that every value fits a signed 64-bit word.
+ */
+bool bigints_fixed_width(const mpz_t* b, const mpz_t* e)
+{
+  if (sizeof(long) != sizeof(int64_t))
+    return false;
+  for (; b != e; ++b)
+    if (!mpz_fits_slong_p(*b))
+      return false;
+  return true;
+}
+
+/** @brief Radix sort for given type on 64-bit key prefixes.
+ *
+ *  Sorts (prefix, index) pairs then permutes the elements, for mpz_t a
+ *  shallow copy of the structs. Runs of equal prefix are finished with
+ *  quicksort_##type, unless exact is set and the fixed keys are exact.
+ *
+ *  @param prefix Order-preserving key prefix of an element.
+ *  @param fixed Order-preserving key of an element that fits 64 bits.
+ *  @param fixed_exact Whether fixed keys are distinct for distinct values.
+ */
+#define RADIXSORT(type,prefix,fixed,fixed_exact,assign) \
+void radixsort_##type(type* b, type* e, bool exact) { \
+  const ptrdiff_t n = e - b; \
+  if (n < 2) \
+    return; \
+  uint64_t* keys = malloc(n * sizeof(uint64_t)); \
+  uint32_t* idx = malloc(n * sizeof(uint32_t)); \
+  perf_begin(PERF_KEYS); \
+  for (ptrdiff_t i = 0; i != n; ++i) { \
+    keys[i] = exact ? fixed(b[i]) : prefix(b[i]); \
+    idx[i] = i; \
+  } \
+  perf_end(PERF_KEYS); \
+  radix_sort_keys(keys, idx, n); \
+  type* tmp = malloc(n * sizeof(type)); \
+  for (ptrdiff_t i = 0; i != n; ++i) \
+    assign(tmp[i], b[idx[i]]); \
+  memcpy(b, tmp, n * sizeof(type)); \
+  free(tmp); \
+  free(idx); \
+  perf_begin(PERF_PARTITION); \
+  if (!(exact && fixed_exact)) \
+    for (ptrdiff_t i = 0, j; i != n; i = j) { \
+      for (j = i + 1; j != n && keys[j] == keys[i]; ++j) \
+        ; \
+      if (j - i > 1) \
+        quicksort_##type(b + i, b + j); \
+    } \
+  perf_end(PERF_PARTITION); \
+  free(keys); \
+}
+
+/** @brief Radix sort bigints, radixsort_mpz_t etc. per order.
+ *
+ *  @param b Begin pointer of input sequence.
+ *  @param e End pointer of input sequence.
+ *  @param exact Values all fit 64 bits; sort on fixed-width keys.
+ */
+RADIXSORT(mpz_t,bigint_prefix,bigint_fixed_key,true,MPZ_SHALLOW_ASSIGN)
+RADIXSORT(mpz_t_desc,bigint_prefix_desc,bigint_fixed_key_desc,true,
+          MPZ_SHALLOW_ASSIGN)
+RADIXSORT(mpz_t_abs,bigint_prefix_abs,bigint_prefix_abs,false,
+          MPZ_SHALLOW_ASSIGN)
+RADIXSORT(mpz_t_bits,bigint_prefix_bits,bigint_prefix_bits,false,
+          MPZ_SHALLOW_ASSIGN)
+
+#endif
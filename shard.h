@@ -0,0 +1,367 @@
+#ifndef SHARD_H
+#define SHARD_H 1
+
+#include <limits.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+#include "order.h"
+#include "quick.h"
+#include "verify.h"
+
+// Splitter sample size per shard
+#define shard_samples_per_shard 64
+
+// Socket stream buffer size
+#define shard_buffer_size (1 << 20)
+
+#define shard_magic 0x42494753   // "BIGS"
+
+/** @brief In-process sort run by each worker on its key range.
+ */
+typedef void (*shard_sort_fn)(bigint_array b, bigint_order order, void* ctx);
+
+/** @brief Write a job, sent coordinator to worker:
+ *
+ *    u32 magic, u32 shard index, u32 sort order, u32 to-file flag,
+ *    then a bigints_write_raw array.
+ *
+ *  Asked to write to file, a worker writes its sorted range to
+ *  PREFIX.INDEX and replies with the count only; otherwise it replies
+ *  with the sorted range as a raw array. All integers big-endian. The
+ *  prefix is the worker's own, never taken off the wire.
+ */
+static bool shard_write_header(FILE* f, uint32_t index, bigint_order order,
+                               bool to_file)
+{
+  return raw_write_u32(f, shard_magic) && raw_write_u32(f, index)
+      && raw_write_u32(f, order) && raw_write_u32(f, to_file);
+}
+
+/** @brief Serve one job on a connected socket.
+ *  @param prefix Output prefix for jobs asking to write to file, as
+ *                set by the worker's owner, or NULL to refuse them.
+ *  @return 0 on success, -1 on protocol or I/O error.
+ */
+int shard_serve_job(int fd, const char* prefix, shard_sort_fn sort,
+                    void* ctx, int num_threads)
+{
+  FILE* in = fdopen(fd, "r");
+  FILE* out = fdopen(dup(fd), "w");
+  if (!in || !out)
+    return -1;
+  setvbuf(in, NULL, _IOFBF, shard_buffer_size);
+  setvbuf(out, NULL, _IOFBF, shard_buffer_size);
+
+  int res = -1;
+  uint32_t magic, index, order, to_file;
+  if (raw_read_u32(in, &magic) && magic == shard_magic
+   && raw_read_u32(in, &index)
+   && raw_read_u32(in, &order) && order < order_num_orders
+   && raw_read_u32(in, &to_file) && to_file <= 1)
+  {
+    if (to_file && !prefix)
+      fprintf(stderr, "shard: worker has no --shard-out prefix\n");
+    bigint_array b = to_file && !prefix ? (bigint_array){}
+                                        : bigints_read_raw(in);
+    if (b.data) {
+      sort(b, order, ctx);
+      if (to_file) {
+        char name[PATH_MAX];
+        snprintf(name, sizeof name, "%s.%u", prefix, index);
+        FILE* f = fopen(name, "w");
+        if (f) {
+          bigints_write(f, b, num_threads);
+          res = fclose(f) == 0 && raw_write_u64(out, b.size) ? 0 : -1;
+        }
+      }
+      else
+        res = bigints_write_raw(out, b) ? 0 : -1;
+      bigints_clear(&b);
+    }
+  }
+  if (fclose(out) != 0)
+    res = -1;
+  fclose(in);
+  return res;
+}
+
+/** @brief Split "host:port" or "port"; host defaults to localhost.
+ */
+static void shard_split_addr(const char* addr, char* host, size_t hn,
+                             const char** port)
+{
+  const char* c = strrchr(addr, ':');
+  snprintf(host, hn, "%.*s", c ? (int)(c - addr) : 9,
+           c ? addr : "localhost");
+  *port = c ? c + 1 : addr;
+}
+
+/** @brief Connect to a worker at "host:port".
+ *  @return Socket, or -1.
+ */
+int shard_connect(const char* addr)
+{
+  char host[256];
+  const char* port;
+  shard_split_addr(addr, host, sizeof host, &port);
+
+  struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *ai, *a;
+  if (getaddrinfo(host, port, &hints, &ai) != 0)
+    return -1;
+  int fd = -1;
+  for (a = ai; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(ai);
+  return fd;
+}
+
+/** @brief Run a TCP worker on "[host:]port", default host localhost.
+ *
+ *  Each connection is served by a forked child, so one coordinator
+ *  can send several shards to the same worker host. Returns only on
+ *  error.
+ *
+ *  @param prefix Output prefix for ranges written to file, from the
+ *                worker's command line, or NULL to stream all back.
+ */
+int shard_serve(const char* addr, const char* prefix, shard_sort_fn sort,
+                void* ctx, int num_threads)
+{
+  char host[256];
+  const char* port;
+  shard_split_addr(addr, host, sizeof host, &port);
+
+  struct addrinfo hints = { .ai_socktype = SOCK_STREAM,
+                            .ai_flags = AI_PASSIVE }, *ai;
+  if (getaddrinfo(host, port, &hints, &ai) != 0) {
+    fprintf(stderr, "shard: bad worker address %s\n", addr);
+    return -1;
+  }
+  int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  int on = 1;
+  if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on)
+   || bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, 64)) {
+    fprintf(stderr, "shard: failed to listen on %s\n", addr);
+    freeaddrinfo(ai);
+    return -1;
+  }
+  freeaddrinfo(ai);
+  signal(SIGCHLD, SIG_IGN);   // no zombies
+
+  for (;;) {
+    int c = accept(fd, NULL, NULL);
+    if (c < 0)
+      continue;
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fd);
+      _exit(shard_serve_job(c, prefix, sort, ctx, num_threads) == 0 ? 0 : 1);
+    }
+    close(c);
+  }
+}
+
+/** @brief Choose k-1 range splitters from an evenly spaced sample.
+ *  @return Splitters, shallow copies into b; free when done.
+ */
+static mpz_t* shard_splitters(bigint_array b, int k, bigint_order order)
+{
+  ptrdiff_t s = (ptrdiff_t)k * shard_samples_per_shard;
+  if (s > b.size)
+    s = b.size;
+  mpz_t* sample = malloc((s + 1) * sizeof(mpz_t));
+  for (ptrdiff_t i = 0; i != s; ++i)
+    MPZ_SHALLOW_ASSIGN(sample[i], b.data[i * b.size / s]);
+  ORDER_CALL(order, quicksort_mpz_t, sample, sample + s);
+
+  mpz_t* split = malloc(k * sizeof(mpz_t));
+  for (int j = 0; j + 1 < k; ++j)
+    MPZ_SHALLOW_ASSIGN(split[j], sample[(j + 1) * s / k]);
+  free(sample);
+  return split;
+}
+
+/** @brief Sort by key range over k worker processes.
+ *
+ *  Range splitters come from a sample of the input. Each range is
+ *  streamed to its worker in the raw binary format, over a Unix-domain
+ *  socketpair to a forked local worker or over TCP to the workers at
+ *  addrs. Workers sort with the in-process algorithms and either
+ *  stream their range back, in which case it is written to out in
+ *  order, or, given shard_out, write it to PREFIX.INDEX: forked
+ *  workers with shard_out as prefix, TCP workers with their own.
+ *
+ *  @param b Big integer 'array' (data ptr & size struct).
+ *  @param k Number of shards.
+ *  @param order Sort order.
+ *  @param addrs Worker addresses "host:port", or NULL to fork k workers.
+ *  @param shard_out Output file prefix for forked workers, or NULL.
+ *  @param sort In-process sort for forked workers.
+ *  @param ctx Context for sort.
+ *  @param out Stream for merged output when streaming back.
+ *  @param vr If not NULL, set to verify result of the streamed output.
+ *  @param num_threads Number of threads allowed for number conversion.
+ *  @return 0 on success, -1 on worker or I/O error.
+ */
+int bigints_sort_sharded(bigint_array b, int k, bigint_order order,
+                         char** addrs,
+                         const char* shard_out, shard_sort_fn sort, void* ctx,
+                         FILE* out, bigints_verify_result* vr, int num_threads)
+{
+  if (k < 1 || k > UINT16_MAX)
+    return -1;
+
+  mpz_t* split = shard_splitters(b, k, order);
+  uint16_t* bucket = malloc((b.size + 1) * sizeof(uint16_t));
+  uint64_t* count = calloc(k, sizeof(uint64_t));
+  uint64_t* first = calloc(k + 1, sizeof(uint64_t));
+  for (uint32_t i = 0; i != b.size; ++i) {
+    int lo = 0, hi = k - 1;
+    while (lo < hi) {
+      int m = (lo + hi) / 2;
+      if (bigint_cmp_order(order, b.data[i], split[m]) < 0)
+        hi = m;
+      else
+        lo = m + 1;
+    }
+    ++count[bucket[i] = lo];
+  }
+  free(split);
+
+  // indices grouped by range, so each range is sent from its slice
+  for (int j = 0; j != k; ++j)
+    first[j + 1] = first[j] + count[j];
+  uint32_t* index = malloc((b.size + 1) * sizeof(uint32_t));
+  {
+    uint64_t* fill = malloc(k * sizeof(uint64_t));
+    memcpy(fill, first, k * sizeof(uint64_t));
+    for (uint32_t i = 0; i != b.size; ++i)
+      index[fill[bucket[i]]++] = i;
+    free(fill);
+  }
+  free(bucket);
+
+  int* fd = malloc(k * sizeof(int));
+  pid_t* pid = calloc(k, sizeof(pid_t));
+  for (int j = 0; j != k; ++j)
+    fd[j] = -1;
+  int res = 0;
+  fflush(NULL);
+  // a refusing worker fails the send instead of killing us; only for
+  // the sends, so that writes to out still stop on a closed pipe
+  void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+  for (int j = 0; j != k; ++j)
+  {
+    if (addrs) {
+      if ((fd[j] = shard_connect(addrs[j])) < 0)
+        fprintf(stderr, "shard: failed to connect to worker %s\n", addrs[j]);
+    }
+    else {
+      int sv[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0) {
+        if ((pid[j] = fork()) == 0) {
+          close(sv[0]);
+          for (int i = 0; i != j; ++i)
+            close(fd[i]);
+          _exit(shard_serve_job(sv[1], shard_out, sort, ctx, num_threads)
+                == 0 ? 0 : 1);
+        }
+        close(sv[1]);
+        fd[j] = pid[j] > 0 ? sv[0] : (close(sv[0]), -1);
+      }
+      if (fd[j] < 0)
+        fprintf(stderr, "shard: failed to start worker %d\n", j);
+    }
+    if (fd[j] < 0) {
+      res = -1;
+      break;
+    }
+
+    // workers read their whole range before replying, so sending all
+    // ranges before reading any reply cannot deadlock
+    FILE* w = fdopen(dup(fd[j]), "w");
+    setvbuf(w, NULL, _IOFBF, shard_buffer_size);
+    bool ok = shard_write_header(w, j, order, shard_out != NULL)
+           && raw_write_u64(w, count[j]);
+    for (uint64_t i = first[j]; ok && i != first[j + 1]; ++i)
+      ok = mpz_out_raw(w, b.data[index[i]]) != 0;
+    if (fclose(w) != 0 || !ok) {
+      fprintf(stderr, "shard: failed to send range %d\n", j);
+      res = -1;
+      break;
+    }
+  }
+  signal(SIGPIPE, sigpipe);
+  free(index);
+  free(first);
+
+  mpz_t x, last;
+  mpz_init(x);
+  mpz_init(last);
+  bigints_verify_result v = { 0, -1 };
+  uint64_t total = 0;
+  for (int j = 0; j != k && res == 0; ++j)
+  {
+    FILE* r = fdopen(dup(fd[j]), "r");
+    setvbuf(r, NULL, _IOFBF, shard_buffer_size);
+    uint64_t n;
+    bool ok = raw_read_u64(r, &n) && n == count[j];
+    for (uint64_t i = 0; ok && !shard_out && i != n && !ferror(out);
+         ++i, ++total) {
+      ok = mpz_inp_raw(x, r) != 0;
+      v.hash += bigint_hash(x);
+      if (total && v.unsorted < 0 && bigint_cmp_order(order, x, last) < 0)
+        v.unsorted = total - 1;
+      bigint_fprint(out, x, num_threads);
+      fputc('\n', out);
+      mpz_swap(x, last);
+    }
+    fclose(r);
+    if (!ok) {
+      fprintf(stderr, "shard: bad reply from worker %d\n", j);
+      res = -1;
+    }
+    else if (!shard_out && (fflush(out) != 0 || ferror(out))) {
+      fprintf(stderr, "shard: failed to write output\n");
+      res = -1;
+    }
+  }
+  mpz_clear(x);
+  mpz_clear(last);
+
+  for (int j = 0; j != k; ++j) {
+    if (fd[j] >= 0)
+      close(fd[j]);
+    int status;
+    if (pid[j] > 0 && (waitpid(pid[j], &status, 0) != pid[j]
+                    || !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+      res = -1;
+  }
+  free(fd);
+  free(pid);
+  free(count);
+  if (vr)
+    *vr = v;
+  return res;
+}
+
+#endif
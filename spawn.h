@@ -0,0 +1,32 @@
+#ifndef SPAWN_H
+#define SPAWN_H 1
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** @brief Run task on each of n task structs, size bytes apart, on a
+ *         thread each; where a thread cannot be started, run it inline.
+ *         Returns when all are done.
+ *  @param inline_first Run the first on the calling thread.
+ */
+void spawn_all(void* (*task)(void*), void* tasks, size_t size, int n,
+               bool inline_first)
+{
+  pthread_t th[n > 0 ? n : 1];
+  bool spawned[n > 0 ? n : 1];
+  for (int i = inline_first; i < n; ++i) {
+    void* t = (char*)tasks + i * size;
+    if (!(spawned[i] = pthread_create(&th[i], NULL, task, t) == 0))
+      task(t);
+  }
+  if (inline_first && n > 0) {
+    spawned[0] = false;
+    task(tasks);
+  }
+  for (int i = 0; i < n; ++i)
+    if (spawned[i])
+      pthread_join(th[i], NULL);
+}
+
+#endif
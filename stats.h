@@ -0,0 +1,67 @@
+#ifndef STATS_H
+#define STATS_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "perf.h"
+
+/** @brief Per-run statistics, reported by --stats as JSON on stderr.
+ */
+typedef struct
+{
+  uint32_t size;
+
+  // Algorithm actually run, and why (auto selection)
+  const char* algorithm;
+  const char* order;
+  char reason[128];
+
+  // Presortedness sample (auto selection)
+  size_t samples;
+  double descent_ratio;
+  double duplicate_ratio;
+  size_t min_limbs;
+  size_t max_limbs;
+
+  // Phase wall times, seconds
+  double read_time;
+  double sort_time;
+  double write_time;
+  double query_time;
+
+} sort_stats;
+
+double stats_now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void stats_print(FILE* fs, const sort_stats* s)
+{
+  fprintf(fs, "{\n"
+              "  \"size\": %u,\n"
+              "  \"algorithm\": \"%s\",\n"
+              "  \"order\": \"%s\",\n"
+              "  \"reason\": \"%s\",\n",
+              s->size, s->algorithm ? s->algorithm : "",
+              s->order ? s->order : "asc", s->reason);
+  if (s->samples)
+    fprintf(fs, "  \"sample\": { \"size\": %zu, \"descent_ratio\": %.4f,"
+                " \"duplicate_ratio\": %.4f, \"min_limbs\": %zu,"
+                " \"max_limbs\": %zu },\n",
+                s->samples, s->descent_ratio, s->duplicate_ratio,
+                s->min_limbs, s->max_limbs);
+  if (perf.enabled)
+    perf_print_json(fs);
+  fprintf(fs, "  \"time\": { \"read\": %.6f, \"sort\": %.6f,"
+              " \"write\": %.6f, \"query\": %.6f }\n"
+              "}\n",
+              s->read_time, s->sort_time, s->write_time, s->query_time);
+}
+
+#endif
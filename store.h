@@ -0,0 +1,580 @@
+#ifndef STORE_H
+#define STORE_H 1
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+#include "merge.h"
+
+// Merge deltas among themselves once there are this many
+#define store_max_deltas 8
+
+// Fold deltas into the base once they hold this fraction of its size
+#define store_delta_ratio (1.0 / 8)
+
+// Stream buffer size per store run
+#define store_buffer_size (1 << 20)
+
+/** @brief Open runs of a store directory.
+ *
+ *  A store is a directory of sorted runs in the raw binary format.
+ *  Inserts add "delta.N", numbered in sequence; a merge of deltas LO
+ *  to HI writes "delta.LO-HI", and a fold into the base "base.HI",
+ *  which covers every delta up to HI. A merged run is synced and
+ *  renamed in before its inputs are unlinked, so a crash in between
+ *  leaves only covered, stale runs, which readers skip. The multiset
+ *  held is the union of the live runs; readers merge them on the fly.
+ *  Directory changes are made under an exclusive flock of DIR/lock and
+ *  runs are opened under a shared one, so a reader sees each merge
+ *  whole.
+ */
+typedef struct
+{
+  int k;
+  FILE** file;
+  char** name;          // file names within the directory
+  uint64_t* lo;         // delta sequence numbers covered, lo to hi
+  uint64_t* hi;
+  uint64_t* count;
+  uint64_t total;
+  int base;             // index of the base run, or -1
+  uint64_t base_count;
+
+} store_runs;
+
+/** @brief A run file name and the delta sequence numbers it covers.
+ */
+typedef struct
+{
+  char* name;
+  uint64_t lo, hi;
+  bool base;
+
+} store_entry;
+
+static void store_path(char* buf, const char* dir, const char* name)
+{
+  snprintf(buf, PATH_MAX, "%s/%s", dir, name);
+}
+
+/** @brief Take a flock on DIR/name.
+ *  @return Lock file descriptor, or -1; close it to unlock.
+ */
+static int store_lock(const char* dir, const char* name, int op)
+{
+  char path[PATH_MAX];
+  store_path(path, dir, name);
+  int fd = open(path, O_RDWR | O_CREAT, 0666);
+  if (fd >= 0 && flock(fd, op) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+/** @brief Flush a written run to disk, then close it.
+ *  @return false on any write error.
+ */
+static bool store_sync_close(FILE* f)
+{
+  bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+  return fclose(f) == 0 && ok;
+}
+
+/** @brief Flush directory entries, so that renames are durable.
+ */
+static bool store_sync_dir(const char* dir)
+{
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  bool ok = fd >= 0 && fsync(fd) == 0;
+  if (fd >= 0)
+    close(fd);
+  return ok;
+}
+
+/** @brief Parse a run file name: "delta.N" covers N to N, "delta.LO-HI"
+ *         LO to HI and "base.HI" 0 to HI.
+ *  @return false if name is not a run.
+ */
+static bool store_entry_parse(const char* name, store_entry* e)
+{
+  unsigned long long lo, hi;
+  char c;
+  *e = (store_entry){ NULL, 0, 0, !strncmp(name, "base", 4) };
+  if (sscanf(name, "base.%llu%c", &hi, &c) == 1)
+    lo = 0;
+  else if (sscanf(name, "delta.%llu-%llu%c", &lo, &hi, &c) == 2 && lo <= hi
+           && lo > 0)
+    ;
+  else if (sscanf(name, "delta.%llu%c", &lo, &c) == 1 && lo > 0)
+    hi = lo;
+  else
+    return false;
+  e->lo = lo;
+  e->hi = hi;
+  return true;
+}
+
+static void store_entries_clear(store_entry* e, int n)
+{
+  for (int i = 0; i != n; ++i)
+    free(e[i].name);
+  free(e);
+}
+
+/** @brief List the run files of a store.
+ *  @return Number of runs, or -1 if the directory cannot be read.
+ */
+static int store_scan(const char* dir, store_entry** entries)
+{
+  DIR* d = opendir(dir);
+  *entries = NULL;
+  if (!d)
+    return -1;
+  int n = 0, cap = 0;
+  store_entry e;
+  for (struct dirent* de; (de = readdir(d)); )
+  {
+    if (!store_entry_parse(de->d_name, &e))
+      continue;
+    if (n == cap) {
+      cap = cap ? 2 * cap : 16;
+      *entries = realloc(*entries, cap * sizeof(store_entry));
+    }
+    e.name = strdup(de->d_name);
+    (*entries)[n++] = e;
+  }
+  closedir(d);
+  return n;
+}
+
+/** @brief True if run i is covered by another: a base below the top
+ *         one, a delta the top base covers, or a delta inside a wider
+ *         merged delta.
+ */
+static bool store_stale(const store_entry* e, int n, int i)
+{
+  uint64_t top = 0;
+  for (int j = 0; j != n; ++j)
+    if (e[j].base && e[j].hi > top)
+      top = e[j].hi;
+  if (e[i].base)
+    return e[i].hi < top;
+  if (e[i].hi <= top)
+    return true;
+  for (int j = 0; j != n; ++j)
+    if (!e[j].base && e[j].lo <= e[i].lo && e[i].hi <= e[j].hi
+                   && e[j].hi - e[j].lo > e[i].hi - e[i].lo)
+      return true;
+  return false;
+}
+
+/** @brief Next delta sequence number; call with DIR/lock held.
+ */
+static uint64_t store_next_seq(const char* dir)
+{
+  store_entry* e;
+  const int n = store_scan(dir, &e);
+  uint64_t seq = 0;
+  for (int i = 0; i < n; ++i)
+    if (e[i].hi > seq)
+      seq = e[i].hi;
+  store_entries_clear(e, n > 0 ? n : 0);
+  return seq + 1;
+}
+
+/** @brief Remove stale runs, left by a merge or a crash during one;
+ *         call with DIR/lock held exclusively.
+ */
+static void store_unlink_stale(const char* dir)
+{
+  store_entry* e;
+  const int n = store_scan(dir, &e);
+  char path[PATH_MAX];
+  for (int i = 0; i < n; ++i)
+    if (store_stale(e, n, i)) {
+      store_path(path, dir, e[i].name);
+      unlink(path);
+    }
+  store_entries_clear(e, n > 0 ? n : 0);
+}
+
+void store_runs_close(store_runs* r)
+{
+  for (int i = 0; i != r->k; ++i) {
+    if (r->file[i])
+      fclose(r->file[i]);
+    free(r->name[i]);
+  }
+  free(r->file);
+  free(r->name);
+  free(r->lo);
+  free(r->hi);
+  free(r->count);
+  *r = (store_runs){ .base = -1 };
+}
+
+/** @brief Open every live run of a store and read its count.
+ *  @return 0 on success, -1 if the store cannot be read.
+ */
+int store_runs_open(const char* dir, store_runs* r)
+{
+  *r = (store_runs){ .base = -1 };
+  int lock = store_lock(dir, "lock", LOCK_SH);
+  store_entry* e = NULL;
+  const int n = lock < 0 ? -1 : store_scan(dir, &e);
+  if (n < 0) {
+    fprintf(stderr, "store: cannot read store %s\n", dir);
+    if (lock >= 0)
+      close(lock);
+    return -1;
+  }
+
+  r->file = malloc((n + 1) * sizeof(FILE*));
+  r->name = malloc((n + 1) * sizeof(char*));
+  r->lo = malloc((n + 1) * sizeof(uint64_t));
+  r->hi = malloc((n + 1) * sizeof(uint64_t));
+  r->count = malloc((n + 1) * sizeof(uint64_t));
+  int res = 0;
+  for (int j = 0; res == 0 && j != n; ++j)
+  {
+    if (store_stale(e, n, j))
+      continue;
+    char path[PATH_MAX];
+    store_path(path, dir, e[j].name);
+    FILE* f = fopen(path, "r");
+    const int i = r->k++;
+    r->file[i] = f;
+    r->name[i] = e[j].name;
+    r->lo[i] = e[j].lo;
+    r->hi[i] = e[j].hi;
+    e[j].name = NULL;
+    if (f)
+      setvbuf(f, NULL, _IOFBF, store_buffer_size);
+    if (!f || !raw_read_u64(f, &r->count[i])) {
+      fprintf(stderr, "store: cannot read run %s\n", path);
+      res = -1;
+      continue;
+    }
+    r->total += r->count[i];
+    if (e[j].base) {
+      r->base = i;
+      r->base_count = r->count[i];
+    }
+  }
+  store_entries_clear(e, n);
+  close(lock);
+  if (res != 0)
+    store_runs_close(r);
+  return res;
+}
+
+/** @brief Streaming k-way merge over open runs.
+ */
+typedef struct
+{
+  store_runs* runs;
+  uint64_t* left;       // records left to read per run
+  loser_tree_mpz_t t;
+  bool error;
+
+} store_cursor;
+
+static bool store_cursor_read(store_cursor* c, int i)
+{
+  if (c->left[i] == 0)
+    return false;
+  --c->left[i];
+  if (!mpz_inp_raw(c->t.head[i], c->runs->file[i])) {
+    fprintf(stderr, "store: bad record in run %s\n", c->runs->name[i]);
+    c->error = true;
+    return false;
+  }
+  return true;
+}
+
+void store_cursor_init(store_cursor* c, store_runs* r)
+{
+  const int k = r->k ? r->k : 1;
+  *c = (store_cursor){ r, calloc(k, sizeof(uint64_t)),
+                       { r->k, calloc(k, sizeof(int)),
+                         calloc(k, sizeof(mpz_t)), calloc(k, sizeof(bool)) } };
+  for (int i = 0; i != r->k; ++i) {
+    mpz_init(c->t.head[i]);
+    c->left[i] = r->count[i];
+    c->t.done[i] = !store_cursor_read(c, i);
+  }
+  if (r->k)
+    loser_tree_init_mpz_t(&c->t);
+}
+
+/** @brief Take the next value in ascending order, checking run order.
+ *  @return false at the end or on error, when c->error is set.
+ */
+bool store_cursor_next(store_cursor* c, mpz_t x)
+{
+  if (c->error || c->runs->k == 0 || c->t.done[c->t.loser[0]])
+    return false;
+  const int w = c->t.loser[0];
+  mpz_swap(x, c->t.head[w]);
+  c->t.done[w] = !store_cursor_read(c, w);
+  if (!c->t.done[w] && mpz_cmp(c->t.head[w], x) < 0) {
+    fprintf(stderr, "store: run %s is not sorted\n", c->runs->name[w]);
+    c->error = true;
+  }
+  loser_tree_replay_mpz_t(&c->t, w);
+  return !c->error;
+}
+
+void store_cursor_clear(store_cursor* c)
+{
+  for (int i = 0; i != c->runs->k; ++i)
+    mpz_clear(c->t.head[i]);
+  free(c->left);
+  free(c->t.loser);
+  free(c->t.head);
+  free(c->t.done);
+}
+
+/** @brief Add a sorted array to a store as a new delta run, creating
+ *         the store if need be. The run is on disk before it is added.
+ *  @return 0 on success, -1 on I/O error.
+ */
+int store_insert(const char* dir, bigint_array b)
+{
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "store: cannot create store %s\n", dir);
+    return -1;
+  }
+  char tmp[PATH_MAX], name[64], path[PATH_MAX];
+  snprintf(name, sizeof name, "tmp.%d", (int)getpid());
+  store_path(tmp, dir, name);
+  FILE* f = fopen(tmp, "w");
+  bool ok = f && bigints_write_raw(f, b);
+  if (f && !store_sync_close(f))
+    ok = false;
+  if (!ok) {
+    fprintf(stderr, "store: cannot write delta in %s\n", dir);
+    unlink(tmp);
+    return -1;
+  }
+
+  int lock = store_lock(dir, "lock", LOCK_EX);
+  snprintf(name, sizeof name, "delta.%llu",
+           (unsigned long long)store_next_seq(dir));
+  store_path(path, dir, name);
+  int res = lock >= 0 && rename(tmp, path) == 0 && store_sync_dir(dir)
+          ? 0 : -1;
+  if (lock >= 0)
+    close(lock);
+  if (res != 0) {
+    fprintf(stderr, "store: cannot add delta to %s\n", dir);
+    unlink(tmp);
+  }
+  return res;
+}
+
+/** @brief Log-structured merge of a store's runs.
+ *
+ *  Deltas are folded into the base once they reach store_delta_ratio
+ *  of it, or always if force; otherwise, once there are
+ *  store_max_deltas of them, the deltas are merged into one. Either
+ *  way the cost is linear in the runs merged. The merged run is
+ *  written aside, synced, and renamed in under the store lock, named
+ *  for the deltas it covers, so readers and inserters carry on
+ *  meanwhile and its inputs turn stale in the same step. Only one
+ *  merge runs at a time: a background merge gives way to a running
+ *  one, a forced merge waits for it.
+ *
+ *  @return 0 on success or nothing to do, -1 on I/O or order error.
+ */
+int store_merge(const char* dir, bool force)
+{
+  int merging = store_lock(dir, "merge.lock",
+                           force ? LOCK_EX : LOCK_EX | LOCK_NB);
+  if (merging < 0 && force)
+    fprintf(stderr, "store: cannot lock %s for merge\n", dir);
+  if (merging < 0)
+    return force ? -1 : 0;   // else another merge is running
+
+  // clear runs a crashed merge left behind
+  int lock = store_lock(dir, "lock", LOCK_EX);
+  if (lock >= 0) {
+    store_unlink_stale(dir);
+    close(lock);
+  }
+
+  store_runs r;
+  if (store_runs_open(dir, &r) != 0) {
+    close(merging);
+    return -1;
+  }
+  const int deltas = r.k - (r.base >= 0);
+  const bool fold = deltas > 0 && (force || r.total - r.base_count
+                                    >= r.base_count * store_delta_ratio);
+  if (!fold && deltas < store_max_deltas) {
+    store_runs_close(&r);
+    close(merging);
+    return 0;
+  }
+  if (!fold && r.base >= 0) {
+    // merge deltas only: leave the base out
+    const int b = r.base, l = r.k - 1;
+    fclose(r.file[b]);
+    free(r.name[b]);
+    r.file[b] = r.file[l];
+    r.name[b] = r.name[l];
+    r.lo[b] = r.lo[l];
+    r.hi[b] = r.hi[l];
+    r.count[b] = r.count[l];
+    r.total -= r.base_count;
+    r.k = l;
+    r.base = -1;
+  }
+  uint64_t lo = UINT64_MAX, hi = 0;
+  for (int i = 0; i != r.k; ++i)
+    if (i != r.base) {
+      lo = r.lo[i] < lo ? r.lo[i] : lo;
+      hi = r.hi[i] > hi ? r.hi[i] : hi;
+    }
+
+  char tmp[PATH_MAX], name[64], path[PATH_MAX];
+  snprintf(name, sizeof name, "tmp.%d", (int)getpid());
+  store_path(tmp, dir, name);
+  FILE* f = fopen(tmp, "w");
+  bool ok = f && raw_write_u64(f, r.total);
+  if (f)
+    setvbuf(f, NULL, _IOFBF, store_buffer_size);
+
+  store_cursor c;
+  store_cursor_init(&c, &r);
+  mpz_t x;
+  mpz_init(x);
+  uint64_t n = 0;
+  while (ok && store_cursor_next(&c, x)) {
+    ok = mpz_out_raw(f, x) != 0;
+    ++n;
+  }
+  ok = ok && !c.error && n == r.total;
+  mpz_clear(x);
+  store_cursor_clear(&c);
+  if (f && !store_sync_close(f))
+    ok = false;
+
+  if (fold)
+    snprintf(name, sizeof name, "base.%llu", (unsigned long long)hi);
+  else
+    snprintf(name, sizeof name, "delta.%llu-%llu", (unsigned long long)lo,
+             (unsigned long long)hi);
+  store_path(path, dir, name);
+  lock = ok ? store_lock(dir, "lock", LOCK_EX) : -1;
+  if (lock >= 0) {
+    ok = rename(tmp, path) == 0 && store_sync_dir(dir);
+    if (ok)
+      store_unlink_stale(dir);
+    close(lock);
+  }
+  if (lock < 0 || !ok) {
+    fprintf(stderr, "store: merge failed in %s\n", dir);
+    unlink(tmp);
+  }
+  store_runs_close(&r);
+  close(merging);
+  return ok ? 0 : -1;
+}
+
+/** @brief Run store_merge in a detached background process.
+ */
+void store_merge_background(const char* dir)
+{
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // the grandchild merges, reparented, so no zombie is left behind;
+    // detached from the caller's session and stdio, so that a pipe or
+    // $(...) reading the caller's output does not wait for the merge
+    if (fork() == 0) {
+      setsid();
+      int null = open("/dev/null", O_RDWR);
+      for (int fd = 0; null >= 0 && fd != 3; ++fd)
+        dup2(null, fd);
+      if (null > 2)
+        close(null);
+      _exit(store_merge(dir, false) == 0 ? 0 : 1);
+    }
+    _exit(0);
+  }
+  if (pid > 0)
+    waitpid(pid, NULL, 0);
+}
+
+/** @brief Write a store's values in ascending order, merged on the fly.
+ *  @return Number written, or -1 on error.
+ */
+int64_t store_list(const char* dir, FILE* out, int num_threads)
+{
+  store_runs r;
+  if (store_runs_open(dir, &r) != 0)
+    return -1;
+  store_cursor c;
+  store_cursor_init(&c, &r);
+  mpz_t x;
+  mpz_init(x);
+  int64_t n = 0;
+  while (store_cursor_next(&c, x)) {
+    bigint_fprint(out, x, num_threads);
+    fputc('\n', out);
+    ++n;
+  }
+  if (c.error)
+    n = -1;
+  mpz_clear(x);
+  store_cursor_clear(&c);
+  store_runs_close(&r);
+  return n;
+}
+
+/** @brief Read a store into one sorted array, merged on the fly.
+ *  @return Array; data is NULL on error, as bigints_read_raw.
+ */
+bigint_array store_read(const char* dir)
+{
+  bigint_array b = {};
+  store_runs r;
+  if (store_runs_open(dir, &r) != 0)
+    return b;
+  if (r.total <= UINT32_MAX)
+    b.data = calloc(r.total + 1, sizeof(bigint));
+  if (b.data) {
+    store_cursor c;
+    store_cursor_init(&c, &r);
+    for (; b.size != r.total; ++b.size) {
+      mpz_init(b.data[b.size]);
+      if (!store_cursor_next(&c, b.data[b.size])) {
+        ++b.size;
+        bigints_clear(&b);
+        break;
+      }
+    }
+    store_cursor_clear(&c);
+  }
+  store_runs_close(&r);
+  return b;
+}
+
+#endif
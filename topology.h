@@ -0,0 +1,179 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H 1
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Where the kernel lists NUMA nodes, as nodeN/cpulist
+#define topology_node_dir "/sys/devices/system/node"
+
+/** @brief Thread placement for --affinity.
+ */
+typedef enum
+{
+  AFFINITY_NONE,      // leave placement to the scheduler
+  AFFINITY_COMPACT,   // fill each node's CPUs before the next node
+  AFFINITY_SCATTER    // round robin over nodes
+
+} affinity_mode;
+
+static const char* affinity_names[] = { "none", "compact", "scatter" };
+
+/** @brief CPUs this process may run on, grouped by NUMA node.
+ */
+typedef struct
+{
+  int num_nodes;
+  int num_cpus;
+  int* cpu;       // CPU numbers, node by node
+  int* first;     // cpu[first[k]..first[k+1]) are on node k
+
+} topology;
+
+/** @brief Parse an affinity mode name.
+ *  @return The mode, or -1 if not recognised.
+ */
+int affinity_parse(const char* s)
+{
+  for (int m = 0; m != 3; ++m)
+    if (!strcmp(s, affinity_names[m]))
+      return m;
+  return -1;
+}
+
+/** @brief Parse a kernel CPU list, "0-3,8,10-11", into a set.
+ */
+static bool topology_parse_cpulist(const char* s, cpu_set_t* set)
+{
+  CPU_ZERO(set);
+  while (*s && *s != '\n') {
+    char* end;
+    long lo = strtol(s, &end, 10), hi = lo;
+    if (end == s)
+      return false;
+    if (*end == '-')
+      hi = strtol(end + 1, &end, 10);
+    for (long c = lo; c <= hi && c < CPU_SETSIZE; ++c)
+      CPU_SET(c, set);
+    s = *end == ',' ? end + 1 : end;
+  }
+  return true;
+}
+
+static int topology_cmp_int(const void* a, const void* b)
+{
+  return *(const int*)a - *(const int*)b;
+}
+
+/** @brief Read the NUMA topology of the CPUs in this process's mask.
+ *
+ *  Without NUMA information, or for CPUs that no node lists, all CPUs
+ *  are taken to be on one node.
+ */
+topology topology_read()
+{
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof allowed, &allowed) != 0) {
+    CPU_ZERO(&allowed);
+    CPU_SET(0, &allowed);
+  }
+  topology t = { 0, 0, malloc(CPU_SETSIZE * sizeof(int)),
+                 malloc((CPU_SETSIZE + 2) * sizeof(int)) };
+
+  int ids[CPU_SETSIZE], num_ids = 0;
+  DIR* d = opendir(topology_node_dir);
+  for (struct dirent* e; d && (e = readdir(d)) && num_ids != CPU_SETSIZE; )
+    if (!strncmp(e->d_name, "node", 4) && e->d_name[4] >= '0'
+                                      && e->d_name[4] <= '9')
+      ids[num_ids++] = atoi(e->d_name + 4);
+  if (d)
+    closedir(d);
+  qsort(ids, num_ids, sizeof(int), topology_cmp_int);
+
+  cpu_set_t seen;
+  CPU_ZERO(&seen);
+  for (int k = 0; k != num_ids; ++k)
+  {
+    char path[64], line[4096];
+    snprintf(path, sizeof path, topology_node_dir "/node%d/cpulist", ids[k]);
+    FILE* f = fopen(path, "r");
+    cpu_set_t set;
+    bool ok = f && fgets(line, sizeof line, f)
+                && topology_parse_cpulist(line, &set);
+    if (f)
+      fclose(f);
+    if (!ok)
+      continue;
+    t.first[t.num_nodes] = t.num_cpus;
+    for (int c = 0; c != CPU_SETSIZE; ++c)
+      if (CPU_ISSET(c, &set) && CPU_ISSET(c, &allowed)
+                             && !CPU_ISSET(c, &seen)) {
+        CPU_SET(c, &seen);
+        t.cpu[t.num_cpus++] = c;
+      }
+    if (t.num_cpus != t.first[t.num_nodes])
+      ++t.num_nodes;
+  }
+
+  // CPUs no node lists, or all CPUs if there is no NUMA information
+  t.first[t.num_nodes] = t.num_cpus;
+  for (int c = 0; c != CPU_SETSIZE; ++c)
+    if (CPU_ISSET(c, &allowed) && !CPU_ISSET(c, &seen))
+      t.cpu[t.num_cpus++] = c;
+  if (t.num_cpus != t.first[t.num_nodes])
+    ++t.num_nodes;
+  t.first[t.num_nodes] = t.num_cpus;
+  return t;
+}
+
+void topology_clear(topology* t)
+{
+  free(t->cpu);
+  free(t->first);
+  *t = (topology){};
+}
+
+/** @brief Node index, 0..num_nodes-1, that thread i is placed on.
+ */
+int topology_thread_node(const topology* t, affinity_mode m, int i)
+{
+  if (m == AFFINITY_SCATTER)
+    return i % t->num_nodes;
+  const int c = i % t->num_cpus;
+  int k = 0;
+  while (t->first[k + 1] <= c)
+    ++k;
+  return k;
+}
+
+/** @brief CPU that thread i is pinned to, or -1 for AFFINITY_NONE.
+ */
+int topology_thread_cpu(const topology* t, affinity_mode m, int i)
+{
+  if (m == AFFINITY_NONE || t->num_cpus == 0)
+    return -1;
+  if (m == AFFINITY_COMPACT)
+    return t->cpu[i % t->num_cpus];
+  const int k = i % t->num_nodes;
+  const int n = t->first[k + 1] - t->first[k];
+  return t->cpu[t->first[k] + i / t->num_nodes % n];
+}
+
+/** @brief Pin the calling thread to one CPU; no-op for cpu < 0.
+ */
+bool topology_pin(int cpu)
+{
+  if (cpu < 0)
+    return true;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+}
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "bigint.h"
 #include "command_options.h"
+#include "perf.h"
 
 void init_curses()
 {
@@ -41,9 +42,9 @@ const char ui_panel[] =
 /*1*/ "\n"
 /*2*/ "Data filename:\n"
 /*3*/ "Sort algorithm:\n"
-/*4*/ "\n"
-/*5*/ "(z):quit (r):read (l):list\n"
-/*6*/ "(q):quicksort (m):mergesort (h):heapsort\n"
+/*4*/ "Perf counters:\n"
+/*5*/ "(z):quit (r):read (l):list (s):sort\n"
+/*6*/ "(q):quicksort (m):mergesort (h):heapsort (a):auto\n"
 /*7*/ "\n"
 /*8*/ "Command: "
 /*9   01234567890123456789  */
@@ -55,14 +56,22 @@ static void finish(int sig)
     exit(0);
 }
 
-int bigint_wprint(WINDOW* w, bigint b)
+int bigint_wprint(WINDOW* w, bigint b, int num_threads)
 {
+  if (mpz_sizeinbase(b, 10) >= 255) {
+    /* number output too big for buf, convert on the heap */
+    char* s = bigint_get_str(b, 10, num_threads);
+    if (!s)
+      return -1;
+    int sn = strlen(s);
+    waddstr(w,s);
+    free(s);
+    return sn;
+  }
   char buf[256];
   int sn = gmp_snprintf(buf,256,"%Zd",b);
   if (sn < 0)
     strcpy(buf," bigint printf error ");
-  else if (sn == 255)
-      /* number output too big for buf, do something */;
   waddstr(w,buf);
   return sn;
 }
@@ -70,8 +79,9 @@ int bigint_wprint(WINDOW* w, bigint b)
 /** @brief UI paged list output of bigint data.
  *
  *  @param bigints Big integer 'array' (data ptr & size struct).
+ *  @param num_threads Number of threads allowed for number conversion.
  */
-void list_less(bigint_array bigints)
+void list_less(bigint_array bigints, int num_threads)
 {
   int maxy = getmaxy(curscr);
   int maxx = getmaxx(curscr);
@@ -84,7 +94,7 @@ void list_less(bigint_array bigints)
   int i = 0;
   while (i != bigints.size)
   {
-    int bp = bigint_wprint(cout,bigints.data[i]);
+    int bp = bigint_wprint(cout,bigints.data[i],num_threads);
     wrefresh(cout);
 
     if (bp < 0)
@@ -120,8 +130,10 @@ void list_less(bigint_array bigints)
  *
  *  @param args Program arguments, parsed from commandline.
  *  @param bigints Big integer 'array' (data ptr & size struct).
+ *  @param sort Sorts bigints with the selected algorithm.
  */
-void ui_loop(arguments* args, bigint_array bigints)
+void ui_loop(arguments* args, bigint_array bigints,
+             void (*sort)(arguments*, bigint_array))
 {
   (void) signal(SIGINT, finish); /* arrange interrupts to terminate */
   init_curses();
@@ -132,13 +144,19 @@ void ui_loop(arguments* args, bigint_array bigints)
     mvaddstr(2,15, get_filename(args));
     printw(" %d", bigints.size);
     mvaddstr(3,16, get_sort_algo(args));
+    char perf_line[128];
+    perf_summary(perf_line, sizeof perf_line, PERF_SORT);
+    mvaddstr(4,15, perf_line);
+    clrtoeol();
     move(8,9);
     int c = getch(); /* accept single keystroke of input */
     switch (c) {     /* process the command keystroke */
       case 'q' :
       case 'm' :
-      case 'h' : addch(c); set_sort_algo(args,c); continue;
-      case 'l' : addch(c); list_less(bigints); continue;
+      case 'h' :
+      case 'a' : addch(c); set_sort_algo(args,c); continue;
+      case 'l' : addch(c); list_less(bigints,get_num_threads(args)); continue;
+      case 's' : addch(c); sort(args,bigints); continue;
       case 'z' : addch(c); break;
       default: continue;
     }
@@ -0,0 +1,167 @@
+#ifndef VERIFY_H
+#define VERIFY_H 1
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gmp.h>
+
+#include "bigint.h"
+#include "compact.h"
+#include "order.h"
+#include "spawn.h"
+
+/** @brief Result of a verify pass over a bigint array.
+ */
+typedef struct
+{
+  uint64_t hash;       // order-independent multiset hash
+  ptrdiff_t unsorted;  // first i with data[i+1] before data[i], or -1
+
+} bigints_verify_result;
+
+static inline uint64_t verify_mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/** @brief Hash of a bigint's signed size and limbs.
+ *
+ *  One multiply and shift per limb, then one full mix, so that hashing
+ *  costs little more than loading the limbs.
+ */
+uint64_t limbs_hash(mp_size_t size, const mp_limb_t* d)
+{
+  const mp_size_t n = size < 0 ? -size : size;
+  uint64_t h = (uint64_t)size ^ 0x9e3779b97f4a7c15ULL;
+  for (mp_size_t i = 0; i != n; ++i) {
+    h = (h ^ d[i]) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 29;
+  }
+  return verify_mix(h);
+}
+
+uint64_t bigint_hash(const bigint b)
+{
+  return limbs_hash(b->_mp_size, mpz_limbs_read(b));
+}
+
+typedef struct
+{
+  const bigint* data;
+  const bigint_pack* pack;  // instead of data, if set
+  ptrdiff_t b, e, n;
+  bool check_order;
+  bigint_order order;
+  volatile ptrdiff_t* unsorted;
+  bigints_verify_result res;
+
+} verify_chunk;
+
+/** @brief Hash, and optionally check order of, one chunk, in one pass.
+ *
+ *  Checks the adjacent pairs (i, i+1) for i in [b, e); the pair that
+ *  straddles the chunk's end is this chunk's, so boundaries are covered.
+ *  Element i+1 is compared while element i is hashed, so each is loaded
+ *  once. Order checks stop at the first inversion, or once any chunk
+ *  has found one before this one; hashing runs to the end.
+ */
+static void* verify_chunk_task(void* arg)
+{
+  verify_chunk* c = arg;
+  const bigint_pack* p = c->pack;
+  bool check = c->check_order;
+  uint64_t h = 0;
+  c->res.unsorted = -1;
+  for (ptrdiff_t i = c->b; i != c->e; ++i)
+  {
+    if (p) {
+      const mp_limb_t* r = p->arena + p->offset[i];
+      h += limbs_hash((mp_size_t)r[0], r + 1);
+    }
+    else
+      h += bigint_hash(c->data[i]);
+
+    if (!check || i + 1 == c->n)
+      continue;
+    if (p ? pack_cmp_order(c->order, p->arena + p->offset[i+1],
+                           p->arena + p->offset[i]) < 0
+          : bigint_cmp_order(c->order, c->data[i+1], c->data[i]) < 0) {
+      c->res.unsorted = i;
+      ptrdiff_t u = *c->unsorted;
+      while ((u < 0 || i < u)
+          && !__atomic_compare_exchange_n(c->unsorted, &u, i, false,
+                  __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        ;
+      check = false;
+    }
+    else if ((i & 1023) == 0) {
+      ptrdiff_t u = __atomic_load_n(c->unsorted, __ATOMIC_RELAXED);
+      check = u < 0 || u >= c->b;
+    }
+  }
+  c->res.hash = h;
+  return NULL;
+}
+
+/** @brief Run verify chunks over the array's elements in parallel.
+ */
+static bigints_verify_result verify_run(const bigint* data,
+                     const bigint_pack* pack, ptrdiff_t n,
+                     bool check_order, bigint_order order,
+                     int num_threads)
+{
+  if (num_threads > n)
+    num_threads = n ? n : 1;
+
+  volatile ptrdiff_t unsorted = -1;
+  verify_chunk chunks[num_threads];
+  for (int t = 0; t != num_threads; ++t)
+    chunks[t] = (verify_chunk){ data, pack, n * t / num_threads,
+                  n * (t + 1) / num_threads, n, check_order, order,
+                  &unsorted };
+  spawn_all(verify_chunk_task, chunks, sizeof(verify_chunk),
+            num_threads, true);
+
+  bigints_verify_result res = { 0, -1 };
+  for (int t = 0; t != num_threads; ++t)
+    res.hash += chunks[t].res.hash;
+  res.unsorted = unsorted;
+  return res;
+}
+
+/** @brief Multiset hash and sortedness check in one parallel pass.
+ *
+ *  The hash is a sum of per-element hashes so it does not depend on
+ *  element order; compare hashes taken before and after sorting to
+ *  check that the output is a permutation of the input.
+ *
+ *  @param b Big integer 'array' (data ptr & size struct).
+ *  @param check_order Check sorted order as well as hashing.
+ *  @param order Sort order to check.
+ *  @param num_threads Number of threads allowed to work on this.
+ */
+bigints_verify_result bigints_verify(bigint_array b, bool check_order,
+                                     bigint_order order, int num_threads)
+{
+  return verify_run((const bigint*)b.data, NULL, b.size, check_order, order,
+                    num_threads);
+}
+
+/** @brief As bigints_verify, for a compact array in offset order.
+ */
+bigints_verify_result bigints_verify_packed(const bigint_pack* p,
+                                  bool check_order, bigint_order order,
+                                  int num_threads)
+{
+  return verify_run(NULL, p, p->size, check_order, order, num_threads);
+}
+
+#endif